@@ -220,6 +220,29 @@
 
 #define configTASK_NOTIFICATION_ARRAY_ENTRIES           1
 
+/* Emulator options (freertos-mock) */
+
+/* Virtual clock: time advances only when every task is blocked */
+#define configMOCK_VIRTUAL_TIME                         0
+
+/* Emulated scheduling: one task runs per core (configNUM_CORES), chosen by priority */
+#define configMOCK_SCHEDULER                            0
+/* Tasks as fibers on one host thread per core instead of one thread each, needs configMOCK_SCHEDULER */
+#define configMOCK_FIBERS                               0
+/* Host threads and TCBs of deleted tasks kept for reuse */
+#define configMOCK_TASK_POOL_SIZE                       0
+/* Smallest task stack in bytes, host library calls need more than MCU code */
+#define configMOCK_MIN_STACK_SIZE                       (64 * 1024)
+/* Queue items: MOCK_QUEUE_LOCKED, or lock-free MOCK_QUEUE_SPSC/_MPMC (no xQueueSendToFront) */
+#define configMOCK_QUEUE_MODE                           0
+/* Ring and stream buffer storage mapped twice, wrapping data stays contiguous (page-sized buffers) */
+#define configMOCK_MIRRORED_RINGS                       0
+
+/* Host scheduling of the task threads: MOCK_HOST_PRIORITY_NONE/_NICE/_FIFO/_RR */
+#define configMOCK_HOST_PRIORITY                        0
+/* Pin tasks to the host CPU of their xCoreID */
+#define configMOCK_HOST_AFFINITY                        0
+
 // backward compatibility for 4.4
 #define xTaskRemoveFromUnorderedEventList vTaskRemoveFromUnorderedEventList
 
@@ -15,8 +15,34 @@ extern "C"
     #include "portmacro.h"
 }
 #include <QThread>
-#include <QDateTime>
+#include <QElapsedTimer>
 #include <QList>
+#ifdef Q_OS_LINUX
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/*--------------------------------------------------------------
+                       PRIVATE DEFINES
+--------------------------------------------------------------*/
+
+/* Set configMOCK_HOST_PRIORITY to non-zero to map task priorities onto QThread priorities */
+#ifndef configMOCK_HOST_PRIORITY
+#define configMOCK_HOST_PRIORITY 0
+#endif
+
+/* Set to 1 to pin tasks to the host CPU of their xCoreID (Linux only) */
+#ifndef configMOCK_HOST_AFFINITY
+#define configMOCK_HOST_AFFINITY 0
+#endif
+
+#ifndef configMOCK_HOST_CPU_OF_CORE
+#define configMOCK_HOST_CPU_OF_CORE(core) (core)
+#endif
+
+#ifndef configNUM_CORES
+#define configNUM_CORES 1
+#endif
 
 /*--------------------------------------------------------------
                        PRIVATE TYPES
@@ -28,13 +54,48 @@ public:
     TaskFunction_t taskCode;
     void *parameters;
     TaskHandle_t *createdTask;
+    UBaseType_t uxPriority;
+    BaseType_t xCoreID;
 
     void run() override
     {
+#if configMOCK_HOST_AFFINITY && defined(Q_OS_LINUX)
+        if (xCoreID >= 0 && xCoreID < configNUM_CORES)
+        {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(configMOCK_HOST_CPU_OF_CORE(xCoreID), &cpus);
+            pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        }
+#endif
         taskCode(parameters);
     }
 };
 
+/*--------------------------------------------------------------
+                      PRIVATE FUNCTIONS
+--------------------------------------------------------------*/
+
+/** Task priorities are spread between the idle and the running thread priority,
+ *  the higher ones are left for the timer and interrupt threads */
+static QThread::Priority prvHostPriority(UBaseType_t uxPriority)
+{
+#if configMOCK_HOST_PRIORITY
+    if (uxPriority == tskIDLE_PRIORITY)
+    {
+        return THREAD_TASK_IDLE_PRIO;
+    }
+    const int lowest = QThread::LowestPriority;
+    const int levels = THREAD_TASK_RUNNING_PRIO - lowest;
+    const int top = (configMAX_PRIORITIES > 2) ? (configMAX_PRIORITIES - 2) : 1;
+    const int level = lowest + (int)(qMin<UBaseType_t>(uxPriority, configMAX_PRIORITIES - 1) - 1) * levels / top;
+    return (QThread::Priority)qMin(level, (int)THREAD_TASK_RUNNING_PRIO);
+#else
+    Q_UNUSED(uxPriority);
+    return QThread::InheritPriority;
+#endif
+}
+
 /*--------------------------------------------------------------
                        PRIVATE DATA
 --------------------------------------------------------------*/
@@ -71,18 +132,18 @@ BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode,
                                    const BaseType_t xCoreID)
 {
     Q_UNUSED(usStackDepth);
-    Q_UNUSED(uxPriority);
-    Q_UNUSED(xCoreID);
 
     tskTaskControlBlock *thread = new tskTaskControlBlock();
     thread->taskCode = pvTaskCode;
     thread->parameters = pvParameters;
     thread->createdTask = pvCreatedTask;
+    thread->uxPriority = qMin<UBaseType_t>(uxPriority, configMAX_PRIORITIES - 1);
+    thread->xCoreID = xCoreID;
     thread->setObjectName(pcName);
 
     thread_list.append(thread);
 
-    thread->start();
+    thread->start(prvHostPriority(thread->uxPriority));
     if (pvCreatedTask)
     {
         *pvCreatedTask = thread;
@@ -149,12 +210,16 @@ void terminateAllTasks(void)
 
 TickType_t xTaskGetTickCount(void)
 {
-    static uint64_t start_tick = 0;
-    if (!start_tick)
+    /* QElapsedTimer uses the monotonic clock of the platform */
+    static QElapsedTimer elapsed = []()
     {
-        start_tick = QDateTime::currentSecsSinceEpoch();
-    }
-    return pdMS_TO_TICKS(QDateTime::currentSecsSinceEpoch() - start_tick);
+        QElapsedTimer timer;
+        timer.start();
+        return timer;
+    }();
+    const quint64 ns = elapsed.nsecsElapsed();
+    const quint64 ns_per_second = 1000000000ULL;
+    return (TickType_t)((ns / ns_per_second) * configTICK_RATE_HZ + ((ns % ns_per_second) * configTICK_RATE_HZ) / ns_per_second);
 }
 
 TickType_t xTaskGetTickCountFromISR(void)
@@ -162,6 +227,30 @@ TickType_t xTaskGetTickCountFromISR(void)
     return xTaskGetTickCount();
 }
 
+void vTaskPrioritySet(TaskHandle_t xTask, UBaseType_t uxNewPriority)
+{
+    tskTaskControlBlock *thread = xTask ? xTask : dynamic_cast<tskTaskControlBlock *>(QThread::currentThread());
+    if (!thread)
+    {
+        return;
+    }
+    thread->uxPriority = qMin<UBaseType_t>(uxNewPriority, configMAX_PRIORITIES - 1);
+#if configMOCK_HOST_PRIORITY
+    thread->setPriority(prvHostPriority(thread->uxPriority));
+#endif
+}
+
+UBaseType_t uxTaskPriorityGet(const TaskHandle_t xTask)
+{
+    tskTaskControlBlock *thread = xTask ? xTask : dynamic_cast<tskTaskControlBlock *>(QThread::currentThread());
+    return thread ? thread->uxPriority : tskIDLE_PRIORITY;
+}
+
+UBaseType_t uxTaskPriorityGetFromISR(const TaskHandle_t xTask)
+{
+    return uxTaskPriorityGet(xTask);
+}
+
 extern "C" void vTaskSuspend(TaskHandle_t xTaskToSuspend)
 {
     Q_UNUSED(xTaskToSuspend);
@@ -181,6 +181,11 @@ static inline void vPortExitCritical( portMUX_TYPE *mux )
 
 #include "esp_timer.h"
 
+static inline uint64_t port_get_time_ns(void)
+{
+    return (uint64_t)esp_timer_get_time()*1000;
+}
+
 static inline unsigned long port_get_time_ms(void)
 {
     return esp_timer_get_time()/1000;
@@ -190,9 +195,18 @@ static inline unsigned long port_get_time_ms(void)
 
 #include <time.h>
 
+/* Monotonic time, not affected by wall clock adjustments. On Linux
+ * clock_gettime() is served by the vDSO and does not enter the kernel. */
+static inline uint64_t port_get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
 static inline unsigned long port_get_time_ms(void)
 {
-    return time(NULL);
+    return port_get_time_ns()/1000000ULL;
 }
 
 #endif
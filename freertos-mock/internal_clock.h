@@ -0,0 +1,72 @@
+#pragma once
+#include <atomic>
+#include <stdint.h>
+extern "C"
+{
+    #include "FreeRTOS.h"
+    #include "portmacro.h"
+}
+
+/*
+ * Set configMOCK_VIRTUAL_TIME to 1 in FreeRTOSConfig.h to run the emulator on a
+ * virtual clock: time only passes while every task is blocked, and then it
+ * jumps straight to the next timeout or timer expiry.
+ */
+#ifndef configMOCK_VIRTUAL_TIME
+#define configMOCK_VIRTUAL_TIME 0
+#endif
+
+/** Tick engine of the emulator, counts configTICK_RATE_HZ ticks of the monotonic clock */
+class InternalClock
+{
+public:
+    /** Ticks since the emulation started, 64-bit so it never wraps */
+    static uint64_t ticks(void)
+    {
+#if configMOCK_VIRTUAL_TIME
+        return virtual_ticks().load(std::memory_order_acquire);
+#else
+        const uint64_t origin = origin_ns();
+        return ns_to_ticks(port_get_time_ns() - origin);
+#endif
+    }
+
+    /** Wrapping kernel tick count, same as xTaskGetTickCount() */
+    static TickType_t tick_count(void)
+    {
+        return (TickType_t)ticks();
+    }
+
+    /** Current tick of the virtual clock, advanced by InternalKernel */
+    static std::atomic<uint64_t> &virtual_ticks(void)
+    {
+        static std::atomic<uint64_t> now(0);
+        return now;
+    }
+
+    /** Monotonic time (see port_get_time_ns()) at which the given tick starts */
+    static uint64_t tick_to_time_ns(uint64_t tick)
+    {
+        return origin_ns() + ticks_to_ns(tick);
+    }
+
+    static uint64_t ns_to_ticks(uint64_t ns)
+    {
+        /* Split to avoid overflowing 64 bits with high tick rates */
+        return (ns / NS_PER_SECOND) * configTICK_RATE_HZ + ((ns % NS_PER_SECOND) * configTICK_RATE_HZ) / NS_PER_SECOND;
+    }
+
+    static uint64_t ticks_to_ns(uint64_t ticks)
+    {
+        return (ticks / configTICK_RATE_HZ) * NS_PER_SECOND + ((ticks % configTICK_RATE_HZ) * NS_PER_SECOND) / configTICK_RATE_HZ;
+    }
+
+private:
+    static const uint64_t NS_PER_SECOND = 1000000000ULL;
+
+    static uint64_t origin_ns(void)
+    {
+        static const uint64_t origin = port_get_time_ns();
+        return origin;
+    }
+};
@@ -0,0 +1,43 @@
+#pragma once
+#include <ucontext.h>
+#include "internal_stack.h"
+
+/*
+ * Set configMOCK_FIBERS to 1 in FreeRTOSConfig.h to run the tasks as fibers
+ * on a single host thread that emulates the core. Task switches only happen
+ * inside the kernel API, so configMOCK_SCHEDULER must be enabled as well.
+ */
+#ifndef configMOCK_FIBERS
+#define configMOCK_FIBERS 0
+#endif
+
+/** Stackful coroutine that runs a task on the thread of the emulated core */
+class InternalFiber
+{
+public:
+    typedef void (*entry_t)(void *);
+
+    InternalFiber() = default;
+    InternalFiber(const InternalFiber &) = delete;
+    InternalFiber &operator=(const InternalFiber &) = delete;
+
+    /**
+     * Prepares the entry call on the stack, the stack must outlive the fiber.
+     * @return false if the context could not be set up
+     */
+    bool create(InternalStack &stack, entry_t entry, void *arg);
+
+    /** Runs the fiber on the calling thread until it suspends */
+    void resume(void);
+
+    /** Called on a fiber, switches back to the thread that resumed it */
+    static void suspend(void);
+
+private:
+    static void trampoline(void);
+
+    ucontext_t context_;
+    ucontext_t caller_;
+    entry_t entry_ = nullptr;
+    void *arg_ = nullptr;
+};
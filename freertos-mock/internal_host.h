@@ -0,0 +1,90 @@
+#pragma once
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+extern "C"
+{
+    #include "FreeRTOS.h"
+}
+
+/*
+ * configMOCK_HOST_PRIORITY selects how task priorities are passed to the host
+ * scheduler. SCHED_FIFO and SCHED_RR need CAP_SYS_NICE (or an RLIMIT_RTPRIO).
+ * A thread may always lower its nice priority, raising it (vTaskPrioritySet(),
+ * priority inheritance) needs CAP_SYS_NICE or an RLIMIT_NICE that reaches the
+ * new level, even for levels of 0 and above.
+ */
+#define MOCK_HOST_PRIORITY_NONE 0 /*< All threads keep the default host priority */
+#define MOCK_HOST_PRIORITY_NICE 1 /*< SCHED_OTHER, every FreeRTOS priority is one nice level */
+#define MOCK_HOST_PRIORITY_FIFO 2 /*< SCHED_FIFO */
+#define MOCK_HOST_PRIORITY_RR 3   /*< SCHED_RR */
+
+#ifndef configMOCK_HOST_PRIORITY
+#define configMOCK_HOST_PRIORITY MOCK_HOST_PRIORITY_NONE
+#endif
+
+/* Nice level of FreeRTOS priority 0, the default maps priorities up to 19 onto nice levels of 0 and above */
+#ifndef configMOCK_HOST_NICE_BASE
+#define configMOCK_HOST_NICE_BASE 19
+#endif
+
+/* SCHED_FIFO/SCHED_RR priority of FreeRTOS priority 0 */
+#ifndef configMOCK_HOST_RT_BASE
+#define configMOCK_HOST_RT_BASE 1
+#endif
+
+#ifndef configNUM_CORES
+#define configNUM_CORES 1
+#endif
+
+/* Set to 1 to pin tasks to the host CPU of their xCoreID */
+#ifndef configMOCK_HOST_AFFINITY
+#define configMOCK_HOST_AFFINITY 0
+#endif
+
+/* Host CPU that emulates a core */
+#ifndef configMOCK_HOST_CPU_OF_CORE
+#define configMOCK_HOST_CPU_OF_CORE(core) (core)
+#endif
+
+/* Host CPU of the helper threads (timer service, scheduler loop, virtual clock), -1 to leave them floating */
+#ifndef configMOCK_HOST_HELPER_CPU
+#define configMOCK_HOST_HELPER_CPU -1
+#endif
+
+/** Mapping of tasks onto host threads: scheduling policy, priority and CPU affinity */
+class InternalHost
+{
+public:
+    /** CPU time and context switches of a host thread */
+    struct ThreadStats
+    {
+        uint64_t cpu_ns = 0;
+        uint32_t voluntary_switches = 0;
+        uint32_t involuntary_switches = 0;
+    };
+
+    /** Kernel id of the calling thread, needed for per-thread nice levels */
+    static pid_t thread_id(void);
+
+    /** Applies the host priority of a FreeRTOS priority to a thread */
+    static void set_priority(pthread_t thread, pid_t tid, UBaseType_t priority);
+
+    /** Pins a thread to the host CPU of a core, other core ids (tskNO_AFFINITY) leave it floating */
+    static void set_core(pthread_t thread, BaseType_t core_id);
+
+    /** Pins the calling helper thread to configMOCK_HOST_HELPER_CPU */
+    static void pin_helper(void);
+
+    /** CPU time of the calling thread in nanoseconds */
+    static uint64_t cpu_time(void);
+
+    /** CPU time of another thread in nanoseconds */
+    static uint64_t cpu_time(pthread_t thread);
+
+    /** Statistics of the calling thread */
+    static ThreadStats thread_stats(void);
+
+    /** Statistics of another thread, the switch counts come from procfs */
+    static ThreadStats thread_stats(pthread_t thread, pid_t tid);
+};
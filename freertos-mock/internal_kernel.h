@@ -0,0 +1,485 @@
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include "internal_clock.h"
+#include "internal_fiber.h"
+
+/** Deadline of a wait that never times out */
+#define KERNEL_WAIT_FOREVER UINT64_MAX
+
+/*
+ * Set configMOCK_SCHEDULER to 1 in FreeRTOSConfig.h to emulate configNUM_CORES
+ * cores: only the tasks holding the run token of a core execute, a token goes
+ * to the highest priority task ready on its core at every kernel API call.
+ */
+#ifndef configMOCK_SCHEDULER
+#define configMOCK_SCHEDULER 0
+#endif
+
+#ifndef configUSE_TIME_SLICING
+#define configUSE_TIME_SLICING 1
+#endif
+
+#ifndef configNUM_CORES
+#define configNUM_CORES 1
+#endif
+
+#if configMOCK_FIBERS && !configMOCK_SCHEDULER
+#error "configMOCK_FIBERS requires configMOCK_SCHEDULER"
+#endif
+
+struct InternalWaiter;
+
+/** Links of a waiter in one intrusive list */
+struct WaitLink
+{
+    InternalWaiter *next = nullptr;
+    InternalWaiter *prev = nullptr;
+    const void *list = nullptr;
+    /** Priority the waiter was queued with by push_by_priority(), like the event list item value in tasks.c */
+    UBaseType_t priority = 0;
+};
+
+/** Queue item passed directly between a sender and a receiver, one of them blocked */
+struct WaitTransfer
+{
+    /** Buffer the item is copied to (receiver) or from (sender) */
+    void *buffer = nullptr;
+    /** The blocked sender called xQueueSendToFront() */
+    bool to_front = false;
+    /** Set by the task on the other side once the item is copied */
+    bool done = false;
+};
+
+/** Scheduling state of a task waiter (configMOCK_SCHEDULER) */
+typedef enum
+{
+    SCHED_NONE,    /*< Blocked, not started or gone */
+    SCHED_READY,   /*< Waits for a run token on the ready list of its core */
+    SCHED_RUNNING, /*< Holds the run token of its core */
+} sched_state_t;
+
+/**
+ * Blocking context of a thread. Tasks own one in their TCB, other threads
+ * (main, timer, GUI) get a thread local one when they call a kernel API.
+ */
+struct InternalWaiter
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    /** Set by the waker, cleared when a new wait starts */
+    bool woken = false;
+    bool timed_out = false;
+    /** Waits in InternalKernel::block() for a wake-up or the timeout, counted as blocked by the virtual clock */
+    bool blocked = false;
+    /** Only task waiters keep the virtual clock from advancing */
+    bool is_task = false;
+    bool exited = false;
+    /** Handle of the task that owns the waiter, NULL for other threads */
+    void *task = nullptr;
+    /** Stack the task runs on, checked for overflows at its kernel calls */
+    std::atomic<InternalStack *> stack{nullptr};
+    /** Incremented for every wait, filters out stale virtual timeouts */
+    uint64_t sequence = 0;
+    bool has_deadline = false;
+    uint64_t deadline = KERNEL_WAIT_FOREVER;
+
+    /** vTaskSuspend() request, the task parks at its next kernel call or wake-up */
+    std::atomic<bool> suspended{false};
+    /** Sequence of the wait the task is parked in, 0 if it runs */
+    std::atomic<uint64_t> parked{0};
+    /** vTaskDelete() from another thread, the task leaves at its next kernel call or wake-up */
+    std::atomic<bool> killed{false};
+
+    /** The task has to stop at its next checkpoint */
+    bool interrupted(void) const
+    {
+        return suspended || killed;
+    }
+
+    /** Link of the wait list the waiter is queued on, protected by the list owner */
+    WaitLink wait_link;
+    /** Item of a blocked queue operation, protected by the list owner as well */
+    WaitTransfer transfer;
+
+    /* Scheduler data, protected by the scheduler lock */
+    /** Changed under the scheduler lock, wait lists read it without it */
+    std::atomic<UBaseType_t> priority{0};
+    /** Core the task is pinned to, -1 if it may run on any core */
+    int affinity = -1;
+    /** Core the task runs on, or the one whose ready list holds it */
+    int core = 0;
+    sched_state_t sched_state = SCHED_NONE;
+    /** Tick when the task got the run token, for time slicing */
+    uint64_t slice_start = 0;
+    std::condition_variable token_granted;
+    WaitLink ready_link;
+    /** Context of the task with configMOCK_FIBERS, NULL for threads */
+    InternalFiber *fiber = nullptr;
+
+    /* Run-time statistics kept by the kernel (configGENERATE_RUN_TIME_STATS) */
+    /** Host CPU time of a fiber, task threads are measured by the host */
+    std::atomic<uint64_t> cpu_ns{0};
+    /** Task switches with configMOCK_SCHEDULER: the task blocked or yielded, or it was preempted */
+    std::atomic<uint32_t> voluntary_switches{0};
+    std::atomic<uint32_t> involuntary_switches{0};
+};
+
+/**
+ * Intrusive FIFO of waiters, protected by the mutex of the object that owns it.
+ * Kernel objects queue their waiters by priority, so front() is the one FreeRTOS would unblock.
+ */
+template <WaitLink InternalWaiter::*Link>
+class IntrusiveWaitList
+{
+public:
+    bool empty(void) const
+    {
+        return head_ == nullptr;
+    }
+
+    void push_back(InternalWaiter *waiter)
+    {
+        WaitLink &link = waiter->*Link;
+        link.list = this;
+        link.next = nullptr;
+        link.prev = tail_;
+        if (tail_)
+        {
+            (tail_->*Link).next = waiter;
+        }
+        else
+        {
+            head_ = waiter;
+        }
+        tail_ = waiter;
+    }
+
+    void push_front(InternalWaiter *waiter)
+    {
+        WaitLink &link = waiter->*Link;
+        link.list = this;
+        link.prev = nullptr;
+        link.next = head_;
+        if (head_)
+        {
+            (head_->*Link).prev = waiter;
+        }
+        else
+        {
+            tail_ = waiter;
+        }
+        head_ = waiter;
+    }
+
+    /**
+     * Queues the waiter behind all waiters of the same or a higher priority.
+     * A later priority change does not move it, as in FreeRTOS.
+     */
+    void push_by_priority(InternalWaiter *waiter)
+    {
+        const UBaseType_t priority = waiter->priority.load(std::memory_order_relaxed);
+        InternalWaiter *before = tail_;
+        while (before && (before->*Link).priority < priority)
+        {
+            before = (before->*Link).prev;
+        }
+        if (!before)
+        {
+            push_front(waiter);
+        }
+        else if (before == tail_)
+        {
+            push_back(waiter);
+        }
+        else
+        {
+            WaitLink &link = waiter->*Link;
+            WaitLink &before_link = before->*Link;
+            link.list = this;
+            link.prev = before;
+            link.next = before_link.next;
+            (before_link.next->*Link).prev = waiter;
+            before_link.next = waiter;
+        }
+        (waiter->*Link).priority = priority;
+    }
+
+    InternalWaiter *front(void) const
+    {
+        return head_;
+    }
+
+    static InternalWaiter *next(const InternalWaiter *waiter)
+    {
+        return (waiter->*Link).next;
+    }
+
+    InternalWaiter *pop_front(void)
+    {
+        InternalWaiter *waiter = head_;
+        if (waiter)
+        {
+            remove(waiter);
+        }
+        return waiter;
+    }
+
+    void remove(InternalWaiter *waiter)
+    {
+        WaitLink &link = waiter->*Link;
+        if (link.list != this)
+        {
+            return;
+        }
+        if (link.prev)
+        {
+            (link.prev->*Link).next = link.next;
+        }
+        else
+        {
+            head_ = link.next;
+        }
+        if (link.next)
+        {
+            (link.next->*Link).prev = link.prev;
+        }
+        else
+        {
+            tail_ = link.prev;
+        }
+        link.next = nullptr;
+        link.prev = nullptr;
+        link.list = nullptr;
+    }
+
+private:
+    InternalWaiter *head_ = nullptr;
+    InternalWaiter *tail_ = nullptr;
+};
+
+typedef IntrusiveWaitList<&InternalWaiter::wait_link> WaitList;
+typedef IntrusiveWaitList<&InternalWaiter::ready_link> ReadyList;
+
+/**
+ * Core of the emulated kernel: blocking and waking of threads and the
+ * virtual clock (configMOCK_VIRTUAL_TIME).
+ */
+class InternalKernel
+{
+public:
+    typedef uint64_t timer_id;
+    typedef std::function<void(void)> timer_callback_t;
+
+    /** Waiter of the calling thread */
+    static InternalWaiter &current_waiter(void);
+
+    /** Binds the waiter of a task to the calling thread */
+    static void bind_waiter(InternalWaiter *waiter);
+
+    /** Absolute deadline of a wait for the given number of ticks */
+    static uint64_t deadline_from_ticks(TickType_t ticks);
+
+    /** Resets the waiter before it is put on a wait list */
+    static void prepare(InternalWaiter &waiter);
+
+    /**
+     * Blocks the calling thread until the waiter is woken or the deadline
+     * (in ticks, see InternalClock) is reached.
+     * @return true if woken, false on timeout
+     */
+    static bool block(InternalWaiter &waiter, uint64_t deadline);
+
+    /** Wakes a blocked waiter, may be called from any thread */
+    static void wake(InternalWaiter &waiter);
+
+    /** Wakes the waiter only if it is still in the wait with this sequence (see prepare()) */
+    static void wake(InternalWaiter &waiter, uint64_t sequence);
+
+    /** The waiter waits for a wake-up or a timeout (eBlocked), may be called from any thread */
+    static bool blocked(InternalWaiter &waiter);
+
+    /**
+     * Starts collecting the tasks woken by the calling thread, for the FromISR calls.
+     * @return the collection it replaces, to be handed back with end_woken() by a nested call
+     */
+    static int collect_woken(void);
+
+    /** Ends a nested collection, the outer one keeps the tasks woken by both */
+    static void end_woken(int outer);
+
+    /** @return true if a task was woken since collect_woken() with a higher priority than the calling one, a thread that is not a task counts as lower */
+    static bool woke_higher_priority(void);
+
+    /**
+     * Suspends a task: it parks at once if it is the calling one, otherwise
+     * when its current wait ends or at its next kernel call.
+     */
+    static void suspend(InternalWaiter &waiter);
+
+    /** Lets a suspended task go on, returns false if it was not suspended */
+    static bool resume(InternalWaiter &waiter);
+
+    /** Parks the calling task for as long as it is suspended, leaves if it is killed */
+    static void checkpoint(void);
+
+    /** Makes a task leave at its next checkpoint, wakes it if it is blocked */
+    static void kill(InternalWaiter &waiter);
+
+    /** Waits until a killed fiber has left, a task thread is joined by its owner instead */
+    static void join(InternalWaiter &waiter);
+
+    /** Accounts the calling task as gone and ends its thread or fiber */
+    [[noreturn]] static void exit_task(void);
+
+    /** Blocks the calling thread for the given number of ticks */
+    static void delay(TickType_t ticks);
+
+    /** Blocks the calling thread until the given tick, periodic wake-ups on absolute ticks do not drift */
+    static void delay_until(uint64_t deadline);
+
+    /** Accounts a new task as running and makes it ready, core_id outside the cores leaves it unpinned */
+    static void task_started(InternalWaiter &waiter, UBaseType_t priority, BaseType_t core_id);
+
+    /** Called by a new task thread before the task code, waits for the run token */
+    static void task_entry(InternalWaiter &waiter);
+
+    /** Changes the scheduling priority of a task, call yield() afterwards */
+    static void set_priority(InternalWaiter &waiter, UBaseType_t priority);
+
+    /**
+     * Accounts a task as gone, called from the task thread or by the reaper.
+     * With configMOCK_FIBERS the reaper waits until the fiber is off the core.
+     */
+    static void task_exited(InternalWaiter &waiter);
+
+    /** Called from vTaskStartScheduler(), starts the virtual clock, the scheduler and the core thread */
+    static void start(void);
+
+    /** Core of the calling task, 0 for other threads */
+    static BaseType_t core_id(void);
+
+    /** taskSCHEDULER_NOT_STARTED, taskSCHEDULER_RUNNING or taskSCHEDULER_SUSPENDED */
+    static BaseType_t scheduler_state(void);
+
+    /**
+     * Scheduling point at the end of a kernel API call: hands the run token
+     * of the core over to a higher priority ready task, or to a task of the
+     * same priority when the time slice is over. A forced yield always rotates between
+     * tasks of the same priority.
+     */
+    static void yield(bool force = false);
+
+    /** vTaskSuspendAll() and xTaskResumeAll(), the latter returns true if it yielded */
+    static void suspend_all(void);
+    static bool resume_all(void);
+
+    /** Virtual clock timers, the callbacks run on the clock thread */
+    static timer_id add_timer(uint64_t delay_ticks, timer_callback_t callback, uint64_t period_ticks);
+    static void remove_timer(timer_id id);
+};
+
+/**
+ * Condition variable whose waits are driven by the kernel (and the virtual
+ * clock). notify_one() wakes the waiter of the highest priority, the longest
+ * waiting one among equals.
+ */
+class InternalCondition
+{
+public:
+    /**
+     * Waits up to the given number of ticks until pred() becomes true, the
+     * lock protects both the predicate and the condition.
+     * @return the final value of pred()
+     */
+    template <typename Pred>
+    bool wait(std::unique_lock<std::mutex> &lock, TickType_t ticks, Pred pred)
+    {
+        if (pred())
+        {
+            return true;
+        }
+        if (ticks == 0)
+        {
+            return false;
+        }
+        const uint64_t deadline = InternalKernel::deadline_from_ticks(ticks);
+        InternalWaiter &waiter = InternalKernel::current_waiter();
+        while (!pred())
+        {
+            if (deadline != KERNEL_WAIT_FOREVER && InternalClock::ticks() >= deadline)
+            {
+                return false;
+            }
+            InternalKernel::prepare(waiter);
+            waiters_.push_by_priority(&waiter);
+            lock.unlock();
+            InternalKernel::block(waiter, deadline);
+            lock.lock();
+            waiters_.remove(&waiter);
+            if (waiter.interrupted())
+            {
+                /* A suspended or killed task does not take the event, pass the wake-up on */
+                notify_one();
+                lock.unlock();
+                InternalKernel::checkpoint();
+                lock.lock();
+            }
+        }
+        return true;
+    }
+
+    /** Waits without a predicate, for one notification or the timeout */
+    bool wait(std::unique_lock<std::mutex> &lock, TickType_t ticks)
+    {
+        if (ticks == 0)
+        {
+            return false;
+        }
+        InternalWaiter &waiter = InternalKernel::current_waiter();
+        InternalKernel::prepare(waiter);
+        waiters_.push_by_priority(&waiter);
+        lock.unlock();
+        bool woken = InternalKernel::block(waiter, InternalKernel::deadline_from_ticks(ticks));
+        lock.lock();
+        waiters_.remove(&waiter);
+        if (waiter.interrupted())
+        {
+            lock.unlock();
+            InternalKernel::checkpoint();
+            lock.lock();
+        }
+        return woken;
+    }
+
+    /** The lock passed to wait() must be held */
+    void notify_one(void)
+    {
+        InternalWaiter *waiter = waiters_.pop_front();
+        if (waiter)
+        {
+            InternalKernel::wake(*waiter);
+        }
+    }
+
+    /** The lock passed to wait() must be held */
+    void notify_all(void)
+    {
+        InternalWaiter *waiter;
+        while ((waiter = waiters_.pop_front()) != nullptr)
+        {
+            InternalKernel::wake(*waiter);
+        }
+    }
+
+    /** Priority the first waiter was queued with, 0 (the idle priority) if none waits. The lock passed to wait() must be held */
+    UBaseType_t top_priority(void) const
+    {
+        const InternalWaiter *waiter = waiters_.front();
+        return waiter ? waiter->wait_link.priority : 0;
+    }
+
+private:
+    WaitList waiters_;
+};
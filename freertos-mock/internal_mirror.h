@@ -0,0 +1,38 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Ring buffers and stream buffers whose size is a multiple of the host page
+ * size get their storage mapped twice back to back, so data that wraps around
+ * the end is contiguous in memory. 0 keeps one plain allocation per buffer.
+ */
+#ifndef configMOCK_MIRRORED_RINGS
+#define configMOCK_MIRRORED_RINGS 0
+#endif
+
+/** Ring storage of size bytes followed by a second mapping of the same pages */
+class InternalMirror
+{
+public:
+    InternalMirror() = default;
+    InternalMirror(const InternalMirror &) = delete;
+    InternalMirror &operator=(const InternalMirror &) = delete;
+    ~InternalMirror();
+
+    /**
+     * Maps the storage, byte size + i is byte i.
+     * @return false if size is not a multiple of the page size or the pages could not be mapped
+     */
+    bool map(size_t size);
+
+    /** Start of the storage, NULL if it is not mapped */
+    uint8_t *base(void) const
+    {
+        return base_;
+    }
+
+private:
+    uint8_t *base_ = nullptr;
+    size_t size_ = 0;
+};
@@ -0,0 +1,78 @@
+#pragma once
+#include <stddef.h>
+extern "C"
+{
+    #include "FreeRTOS.h"
+}
+
+/* Smallest task stack in bytes, host library calls need more than MCU code */
+#ifndef configMOCK_MIN_STACK_SIZE
+#define configMOCK_MIN_STACK_SIZE (64 * 1024)
+#endif
+
+#ifndef configCHECK_FOR_STACK_OVERFLOW
+#define configCHECK_FOR_STACK_OVERFLOW 0
+#endif
+
+/* Stacks are filled with a known value for the same reasons as in tasks.c */
+#if configCHECK_FOR_STACK_OVERFLOW > 1 || configUSE_TRACE_FACILITY == 1 || INCLUDE_uxTaskGetStackHighWaterMark == 1 || INCLUDE_uxTaskGetStackHighWaterMark2 == 1
+#define MOCK_STACK_PAINTING 1
+#else
+#define MOCK_STACK_PAINTING 0
+#endif
+
+/** Task stack: a mapping with a guard page below it, or a buffer given by the application */
+class InternalStack
+{
+public:
+    InternalStack() = default;
+    InternalStack(const InternalStack &) = delete;
+    InternalStack &operator=(const InternalStack &) = delete;
+    ~InternalStack();
+
+    /**
+     * Maps at least size bytes plus a guard page and paints them, a mapping
+     * of a deleted task is reused if it has the same size.
+     * @return false if the memory could not be mapped
+     */
+    bool allocate(size_t size);
+
+    /** Uses the application buffer, there is no guard page in front of it */
+    void borrow(void *buffer, size_t size);
+
+    /** Lowest address of the stack, it grows down towards it */
+    char *base(void) const
+    {
+        return base_;
+    }
+
+    size_t size(void) const
+    {
+        return size_;
+    }
+
+    /** The stack is mapped here, not an application buffer */
+    bool owned(void) const
+    {
+        return mapping_ != nullptr;
+    }
+
+    /**
+     * Paints again what a previous task left below limit. A thread repaints
+     * its own stack with a limit a little below its stack pointer.
+     */
+    void repaint(const char *limit);
+
+    /** Deepest point the stack was written to, the base if painting is off */
+    const char *deepest(void) const;
+
+    /** configCHECK_FOR_STACK_OVERFLOW: sp at the base (method 1) or the lowest bytes written (method 2) */
+    bool overflowed(const char *sp) const;
+
+private:
+    char *base_ = nullptr;
+    size_t size_ = 0;
+    /** Whole mapping including the guard page, NULL for a borrowed buffer */
+    void *mapping_ = nullptr;
+    size_t mapping_size_ = 0;
+};
@@ -0,0 +1,61 @@
+#pragma once
+#include <stddef.h>
+#include <condition_variable>
+#include <mutex>
+#include "internal_stack.h"
+
+/*
+ * Number of deleted tasks whose host thread and TCB memory are kept for the
+ * next xTaskCreate(). 0 gives every task a thread of its own.
+ */
+#ifndef configMOCK_TASK_POOL_SIZE
+#define configMOCK_TASK_POOL_SIZE 0
+#endif
+
+/** Host threads that run task functions and park between tasks */
+class InternalThreadPool
+{
+public:
+    typedef void (*entry_t)(void *);
+
+    /** Host thread with its stack, opaque outside the pool */
+    struct Worker;
+
+    /** Function run by a pool thread, owned by the caller until it is joined */
+    struct Job
+    {
+        entry_t entry = nullptr;
+        void *arg = nullptr;
+        /** Smallest stack for the job, the size of stack_buffer if it is set */
+        size_t stack_size = 0;
+        /** Application buffer to run on, the thread exits with the job then */
+        void *stack_buffer = nullptr;
+        /** Stack the job runs on, set before the entry function is called */
+        InternalStack *stack = nullptr;
+        std::mutex mutex;
+        std::condition_variable done;
+        bool started = false;
+        bool finished = false;
+        /** Thread that exits after the job, join() collects it */
+        Worker *retired = nullptr;
+    };
+
+    /**
+     * Runs job.entry(job.arg) on a parked thread with a large enough stack,
+     * spawns a new one if none is parked.
+     * @return false if no thread could be spawned
+     */
+    static bool start(Job &job);
+
+    /** Waits for the entry function to end, the thread is parked already by then */
+    static void join(Job &job);
+
+    /** Spawns parked threads with stack_size bytes of stack until the pool holds count of them */
+    static void reserve(size_t count, size_t stack_size);
+
+    /**
+     * Ends the entry function of the calling pool thread. The stack is unwound
+     * like with pthread_exit(), so a catch (...) in task code must rethrow.
+     */
+    [[noreturn]] static void exit(void);
+};
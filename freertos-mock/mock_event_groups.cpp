@@ -14,8 +14,8 @@ extern "C"
     #include "event_groups.h"
 }
 #include <mutex>
-#include <condition_variable>
 #include <atomic>
+#include "internal_kernel.h"
 
 /*--------------------------------------------------------------
                        PRIVATE TYPES
@@ -24,7 +24,7 @@ extern "C"
 struct EventGroup_t
 {
     std::mutex mutex;
-    std::condition_variable condition;
+    InternalCondition condition;
     std::atomic<EventBits_t> bits;
 };
 
@@ -38,7 +38,10 @@ EventBits_t xEventGroupSetBits(EventGroupHandle_t xEventGroup, const EventBits_t
     std::unique_lock<std::mutex> locker(group->mutex);
     group->bits |= uxBitsToSet;
     group->condition.notify_all();
-    return group->bits.load();
+    const EventBits_t bits = group->bits.load();
+    locker.unlock();
+    InternalKernel::yield();
+    return bits;
 }
 
 EventGroupHandle_t xEventGroupCreate()
@@ -69,39 +72,20 @@ EventBits_t xEventGroupWaitBits(EventGroupHandle_t xEventGroup, const EventBits_
     EventGroup_t *group = reinterpret_cast<EventGroup_t *>(xEventGroup);
     std::unique_lock<std::mutex> locker(group->mutex);
 
-    while (true)
+    auto satisfied = [group, uxBitsToWaitFor, xWaitForAllBits]()
     {
-        if (xWaitForAllBits)
-        {
-            if ((group->bits.load() & uxBitsToWaitFor) == uxBitsToWaitFor)
-            {
-                if (xClearOnExit)
-                {
-                    group->bits.fetch_and(~uxBitsToWaitFor);
-                }
-                return group->bits.load();
-            }
-        }
-        else
-        {
-            if (group->bits.load() & uxBitsToWaitFor)
-            {
-                if (xClearOnExit)
-                {
-                    group->bits.fetch_and(~uxBitsToWaitFor);
-                }
-                return group->bits.load();
-            }
-        }
-
-        if (xTicksToWait == 0)
-        {
-            return 0; // Timeout expired
-        }
+        const EventBits_t bits = group->bits.load() & uxBitsToWaitFor;
+        return xWaitForAllBits ? (bits == uxBitsToWaitFor) : (bits != 0);
+    };
 
-        if (group->condition.wait_for(locker, std::chrono::milliseconds(xTicksToWait)) == std::cv_status::timeout)
-        {
-            return 0; // Timeout expired
-        }
+    if (!group->condition.wait(locker, xTicksToWait, satisfied))
+    {
+        return group->bits.load(); // Timeout expired
+    }
+    const EventBits_t bits = group->bits.load();
+    if (xClearOnExit)
+    {
+        group->bits.fetch_and(~uxBitsToWaitFor);
     }
+    return bits;
 }
@@ -0,0 +1,61 @@
+/**
+ * @file mock_fiber.cpp
+ * @author Stanislav Karpikov
+ * @brief Mock layer for FreeRTOS, fiber contexts of the cooperative backend
+ */
+
+/*--------------------------------------------------------------
+                       INCLUDES
+--------------------------------------------------------------*/
+
+#include "internal_fiber.h"
+
+/*--------------------------------------------------------------
+                       PRIVATE DATA
+--------------------------------------------------------------*/
+
+/** Fiber running on the calling thread */
+static thread_local InternalFiber *current_fiber = nullptr;
+
+/*--------------------------------------------------------------
+                      PUBLIC FUNCTIONS
+--------------------------------------------------------------*/
+
+bool InternalFiber::create(InternalStack &stack, entry_t entry, void *arg)
+{
+    if (getcontext(&context_) != 0)
+    {
+        return false;
+    }
+    entry_ = entry;
+    arg_ = arg;
+    context_.uc_stack.ss_sp = stack.base();
+    context_.uc_stack.ss_size = stack.size();
+    context_.uc_link = nullptr;
+    makecontext(&context_, &InternalFiber::trampoline, 0);
+    return true;
+}
+
+void InternalFiber::resume(void)
+{
+    current_fiber = this;
+    swapcontext(&caller_, &context_);
+    current_fiber = nullptr;
+}
+
+void InternalFiber::suspend(void)
+{
+    InternalFiber *fiber = current_fiber;
+    swapcontext(&fiber->context_, &fiber->caller_);
+}
+
+void InternalFiber::trampoline(void)
+{
+    InternalFiber *fiber = current_fiber;
+    fiber->entry_(fiber->arg_);
+    /* There is no context to return to, the kernel never resumes a finished task */
+    while (true)
+    {
+        suspend();
+    }
+}
@@ -0,0 +1,271 @@
+/**
+ * @file mock_host.cpp
+ * @author Stanislav Karpikov
+ * @brief Mock layer for FreeRTOS, host scheduling of the task threads
+ */
+
+/*--------------------------------------------------------------
+                       INCLUDES
+--------------------------------------------------------------*/
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "internal_host.h"
+
+/*--------------------------------------------------------------
+                       PRIVATE DEFINES
+--------------------------------------------------------------*/
+
+#define HOST_AFFINITY_USED (configMOCK_HOST_AFFINITY || configMOCK_HOST_HELPER_CPU >= 0)
+#define HOST_SCHEDULING_USED (HOST_AFFINITY_USED || configMOCK_HOST_PRIORITY != MOCK_HOST_PRIORITY_NONE)
+
+/*--------------------------------------------------------------
+                       PRIVATE DATA
+--------------------------------------------------------------*/
+
+#if HOST_SCHEDULING_USED
+static std::atomic<bool> priority_warned(false);
+static std::atomic<bool> affinity_warned(false);
+#endif
+
+/*--------------------------------------------------------------
+                       PRIVATE FUNCTIONS
+--------------------------------------------------------------*/
+
+#if HOST_SCHEDULING_USED
+/** Host scheduling errors are reported once, the emulation goes on without them */
+static void prvWarnOnce(std::atomic<bool> &warned, const char *what, int error)
+{
+    if (!warned.exchange(true))
+    {
+        printf("FreeRTOS mock: %s failed (%s), keeping the host defaults\n", what, strerror(error));
+    }
+}
+#endif
+
+#if configMOCK_HOST_AFFINITY
+static cpu_set_t prvInitialCpus(void)
+{
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) != 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            CPU_SET(cpu, &cpus);
+        }
+    }
+    return cpus;
+}
+
+/** Affinity of the process at start-up, taken before any thread is pinned */
+static const cpu_set_t initial_cpus = prvInitialCpus();
+#endif
+
+#if configMOCK_HOST_PRIORITY == MOCK_HOST_PRIORITY_NICE
+/** true if the effective capabilities of the process include CAP_SYS_NICE */
+static bool prvHasSysNice(void)
+{
+    FILE *status = fopen("/proc/self/status", "r");
+    if (!status)
+    {
+        return false;
+    }
+    unsigned long long caps = 0;
+    char line[128];
+    while (fgets(line, sizeof(line), status))
+    {
+        if (sscanf(line, "CapEff: %llx", &caps) == 1)
+        {
+            break;
+        }
+    }
+    fclose(status);
+    return (caps >> 23) & 1; /* CAP_SYS_NICE */
+}
+
+/**
+ * Without CAP_SYS_NICE a nice level can only go below the current one down to 20 - RLIMIT_NICE.
+ * Warns once, before the first failure, if the highest priority needs a lower level than that.
+ */
+static bool prvCheckNiceLimit(void)
+{
+    const int lowest = std::max(-20, (int)configMOCK_HOST_NICE_BASE - ((int)configMAX_PRIORITIES - 1));
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NICE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY || 20 - (int)limit.rlim_cur <= lowest)
+    {
+        return true;
+    }
+    if (prvHasSysNice())
+    {
+        return true;
+    }
+    priority_warned = true;
+    printf("FreeRTOS mock: RLIMIT_NICE allows nice levels down to %d, priority %d needs %d, "
+           "raising a task priority fails without CAP_SYS_NICE\n",
+           20 - (int)limit.rlim_cur, (int)configMAX_PRIORITIES - 1, lowest);
+    return false;
+}
+#endif
+
+#if HOST_AFFINITY_USED
+static void prvPin(pthread_t thread, int cpu)
+{
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+    {
+        prvWarnOnce(affinity_warned, "CPU affinity", EINVAL);
+        return;
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    int error = pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+    if (error)
+    {
+        prvWarnOnce(affinity_warned, "CPU affinity", error);
+    }
+}
+#endif
+
+static uint64_t prvClockNs(clockid_t clock)
+{
+    struct timespec now;
+    if (clock_gettime(clock, &now) != 0)
+    {
+        return 0;
+    }
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+/*--------------------------------------------------------------
+                      PUBLIC FUNCTIONS
+--------------------------------------------------------------*/
+
+pid_t InternalHost::thread_id(void)
+{
+    return (pid_t)syscall(SYS_gettid);
+}
+
+void InternalHost::set_priority(pthread_t thread, pid_t tid, UBaseType_t priority)
+{
+#if configMOCK_HOST_PRIORITY == MOCK_HOST_PRIORITY_NICE
+    (void)thread;
+    /* Lowering the nice level raises the priority, which needs CAP_SYS_NICE or a large enough RLIMIT_NICE */
+    static const bool nice_allowed = prvCheckNiceLimit();
+    (void)nice_allowed;
+    const int nice = std::max(-20, std::min(19, (int)configMOCK_HOST_NICE_BASE - (int)priority));
+    if (setpriority(PRIO_PROCESS, tid, nice) != 0)
+    {
+        prvWarnOnce(priority_warned, "setpriority", errno);
+    }
+#elif configMOCK_HOST_PRIORITY == MOCK_HOST_PRIORITY_FIFO || configMOCK_HOST_PRIORITY == MOCK_HOST_PRIORITY_RR
+    (void)tid;
+    const int policy = (configMOCK_HOST_PRIORITY == MOCK_HOST_PRIORITY_FIFO) ? SCHED_FIFO : SCHED_RR;
+    struct sched_param param;
+    param.sched_priority = std::min(sched_get_priority_max(policy), (int)configMOCK_HOST_RT_BASE + (int)priority);
+    int error = pthread_setschedparam(thread, policy, &param);
+    if (error)
+    {
+        prvWarnOnce(priority_warned, "pthread_setschedparam", error);
+    }
+#else
+    (void)thread;
+    (void)tid;
+    (void)priority;
+#endif
+}
+
+void InternalHost::set_core(pthread_t thread, BaseType_t core_id)
+{
+#if configMOCK_HOST_AFFINITY
+    if (core_id < 0 || core_id >= configNUM_CORES)
+    {
+        /* A recycled thread may still be pinned by its previous task */
+        int error = pthread_setaffinity_np(thread, sizeof(initial_cpus), &initial_cpus);
+        if (error)
+        {
+            prvWarnOnce(affinity_warned, "CPU affinity", error);
+        }
+        return;
+    }
+    prvPin(thread, configMOCK_HOST_CPU_OF_CORE(core_id));
+#else
+    (void)thread;
+    (void)core_id;
+#endif
+}
+
+void InternalHost::pin_helper(void)
+{
+#if configMOCK_HOST_HELPER_CPU >= 0
+    prvPin(pthread_self(), configMOCK_HOST_HELPER_CPU);
+#endif
+}
+
+uint64_t InternalHost::cpu_time(void)
+{
+    return prvClockNs(CLOCK_THREAD_CPUTIME_ID);
+}
+
+uint64_t InternalHost::cpu_time(pthread_t thread)
+{
+    clockid_t clock;
+    if (pthread_getcpuclockid(thread, &clock) != 0)
+    {
+        return 0;
+    }
+    return prvClockNs(clock);
+}
+
+InternalHost::ThreadStats InternalHost::thread_stats(void)
+{
+    ThreadStats stats;
+    stats.cpu_ns = cpu_time();
+    struct rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage) == 0)
+    {
+        stats.voluntary_switches = (uint32_t)usage.ru_nvcsw;
+        stats.involuntary_switches = (uint32_t)usage.ru_nivcsw;
+    }
+    return stats;
+}
+
+InternalHost::ThreadStats InternalHost::thread_stats(pthread_t thread, pid_t tid)
+{
+    if (pthread_equal(thread, pthread_self()))
+    {
+        return thread_stats();
+    }
+    ThreadStats stats;
+    stats.cpu_ns = cpu_time(thread);
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/task/%d/status", (int)tid);
+    FILE *status = fopen(path, "r");
+    if (!status)
+    {
+        return stats;
+    }
+    char line[128];
+    unsigned long count;
+    while (fgets(line, sizeof(line), status))
+    {
+        if (sscanf(line, "voluntary_ctxt_switches: %lu", &count) == 1)
+        {
+            stats.voluntary_switches = (uint32_t)count;
+        }
+        else if (sscanf(line, "nonvoluntary_ctxt_switches: %lu", &count) == 1)
+        {
+            stats.involuntary_switches = (uint32_t)count;
+        }
+    }
+    fclose(status);
+    return stats;
+}
@@ -0,0 +1,1170 @@
+/**
+ * @file mock_kernel.cpp
+ * @author Stanislav Karpikov
+ * @brief Mock layer for FreeRTOS, blocking primitives, scheduler and virtual clock
+ */
+
+/*--------------------------------------------------------------
+                       INCLUDES
+--------------------------------------------------------------*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+#include "internal_host.h"
+#include "internal_kernel.h"
+#include "internal_thread_pool.h"
+extern "C"
+{
+    #include "task.h"
+}
+
+/*--------------------------------------------------------------
+                       PRIVATE TYPES
+--------------------------------------------------------------*/
+
+/** Timeout of a blocked waiter on the virtual clock */
+struct TimedWaiter
+{
+    InternalWaiter *waiter;
+    uint64_t sequence;
+};
+
+/** Timer on the virtual clock */
+struct VirtualTimer
+{
+    InternalKernel::timer_id id;
+    InternalKernel::timer_callback_t callback;
+    uint64_t period;
+};
+
+#if configMOCK_SCHEDULER
+/** Emulated core, protected by sched_mutex */
+struct SchedCore
+{
+    /** Holder of the run token */
+    InternalWaiter *running = nullptr;
+    /** Tasks waiting for this core, unpinned ones may be stolen by an idle core */
+    ReadyList ready_lists[configMAX_PRIORITIES];
+#if configMOCK_FIBERS
+    /** Fiber the core thread is executing, it may have lost the run token already */
+    InternalWaiter *current = nullptr;
+    std::condition_variable wakeup;
+#endif
+};
+#endif
+
+/*--------------------------------------------------------------
+                       PRIVATE DATA
+--------------------------------------------------------------*/
+
+static thread_local InternalWaiter *current_waiter_ptr = nullptr;
+/** Highest priority of the tasks woken by the calling thread since collect_woken(), -1 if none */
+static thread_local int woken_priority = -1;
+static std::atomic<bool> kernel_started(false);
+/** Nesting of vTaskSuspendAll() */
+static std::atomic<UBaseType_t> kernel_suspended(0);
+
+#if configMOCK_SCHEDULER
+static std::mutex sched_mutex;
+static SchedCore cores[configNUM_CORES];
+#endif
+
+#if configMOCK_FIBERS
+static std::condition_variable core_released;
+#if !configMOCK_VIRTUAL_TIME
+/** Timeouts of blocked fibers, protected by sched_mutex */
+static std::condition_variable timeouts_changed;
+static std::multimap<uint64_t, TimedWaiter> fiber_timeouts;
+#endif
+#endif
+
+#if configMOCK_VIRTUAL_TIME
+static std::mutex clock_mutex;
+static std::condition_variable clock_changed;
+/** Tasks that are neither blocked nor gone, the clock stands still while there are any */
+static int running_tasks = 0;
+static bool clock_started = false;
+static std::multimap<uint64_t, TimedWaiter> timed_waiters;
+static std::multimap<uint64_t, VirtualTimer> virtual_timers;
+static InternalKernel::timer_id next_timer_id = 1;
+#endif
+
+/*--------------------------------------------------------------
+                       PRIVATE FUNCTIONS
+--------------------------------------------------------------*/
+
+/** Kernel calls play the part of the context switches where tasks.c checks the stack */
+static void prvCheckStack(InternalWaiter &waiter)
+{
+#if configCHECK_FOR_STACK_OVERFLOW > 0
+    InternalStack *stack = waiter.stack.load(std::memory_order_relaxed);
+    if (stack && stack->overflowed(static_cast<const char *>(__builtin_frame_address(0))))
+    {
+        TaskHandle_t task = static_cast<TaskHandle_t>(waiter.task);
+        vApplicationStackOverflowHook(task, pcTaskGetName(task));
+    }
+#else
+    (void)waiter;
+#endif
+}
+
+#if configMOCK_VIRTUAL_TIME || configMOCK_FIBERS
+
+/** Must be called with the lock of the timeout map held */
+static void prvRemoveTimedWaiter(std::multimap<uint64_t, TimedWaiter> &timeouts, InternalWaiter &waiter)
+{
+    if (!waiter.has_deadline)
+    {
+        return;
+    }
+    auto range = timeouts.equal_range(waiter.deadline);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        if (it->second.waiter == &waiter)
+        {
+            timeouts.erase(it);
+            break;
+        }
+    }
+    waiter.has_deadline = false;
+}
+
+#endif
+
+#if configMOCK_VIRTUAL_TIME
+
+/** Must be called with clock_mutex held */
+static void prvNotifyClock(void)
+{
+    if (running_tasks == 0)
+    {
+        clock_changed.notify_one();
+    }
+}
+
+#endif
+
+#if configMOCK_SCHEDULER
+
+/** Must be called with sched_mutex held, -1 if no task is ready on the core */
+static int prvTopReadyPriority(const SchedCore &core)
+{
+    for (int priority = configMAX_PRIORITIES - 1; priority >= 0; priority--)
+    {
+        if (!core.ready_lists[priority].empty())
+        {
+            return priority;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Highest priority unpinned task ready on another core with a priority above
+ * the given one, must be called with sched_mutex held.
+ */
+static InternalWaiter *prvFindStealable(int core_index, int above)
+{
+    InternalWaiter *found = nullptr;
+    for (int other = 0; other < configNUM_CORES; other++)
+    {
+        if (other == core_index)
+        {
+            continue;
+        }
+        for (int priority = configMAX_PRIORITIES - 1; priority > above; priority--)
+        {
+            const ReadyList &list = cores[other].ready_lists[priority];
+            InternalWaiter *waiter = list.front();
+            while (waiter && waiter->affinity >= 0)
+            {
+                waiter = ReadyList::next(waiter);
+            }
+            if (waiter)
+            {
+                found = waiter;
+                above = priority;
+                break;
+            }
+        }
+    }
+    return found;
+}
+
+/** Priority of the best task the core could run next, -1 if there is none */
+static int prvTopPriorityFor(int core_index)
+{
+    const int own = prvTopReadyPriority(cores[core_index]);
+    const InternalWaiter *stealable = prvFindStealable(core_index, own);
+    return stealable ? (int)stealable->priority : own;
+}
+
+/** Must be called with sched_mutex held */
+static void prvMakeReady(InternalWaiter &waiter, bool front)
+{
+    if (!waiter.is_task || waiter.exited || waiter.sched_state != SCHED_NONE)
+    {
+        return;
+    }
+    waiter.sched_state = SCHED_READY;
+    if (waiter.affinity >= 0)
+    {
+        waiter.core = waiter.affinity;
+    }
+    ReadyList &list = cores[waiter.core].ready_lists[waiter.priority];
+    if (front)
+    {
+        list.push_front(&waiter);
+    }
+    else
+    {
+        list.push_back(&waiter);
+    }
+}
+
+/**
+ * Passes a free run token of a core to the highest priority task ready on it,
+ * or to an unpinned task of a higher priority stolen from another core. Must
+ * be called with sched_mutex held.
+ */
+static void prvDispatchCore(int core_index)
+{
+    SchedCore &core = cores[core_index];
+    if (!kernel_started || core.running)
+    {
+        return;
+    }
+    const int own = prvTopReadyPriority(core);
+    InternalWaiter *next = prvFindStealable(core_index, own);
+    if (next)
+    {
+        cores[next->core].ready_lists[next->priority].remove(next);
+        next->core = core_index;
+    }
+    else if (own >= 0)
+    {
+        next = core.ready_lists[own].pop_front();
+    }
+    else
+    {
+        return;
+    }
+    next->sched_state = SCHED_RUNNING;
+    next->slice_start = InternalClock::ticks();
+    core.running = next;
+#if configMOCK_FIBERS
+    core.wakeup.notify_one();
+#else
+    next->token_granted.notify_one();
+#endif
+}
+
+/** Fills every idle core, must be called with sched_mutex held */
+static void prvDispatch(void)
+{
+    for (int core_index = 0; core_index < configNUM_CORES; core_index++)
+    {
+        prvDispatchCore(core_index);
+    }
+}
+
+/** Takes the waiter off its core and off the ready lists, must be called with sched_mutex held */
+static void prvUnschedule(InternalWaiter &waiter)
+{
+    SchedCore &core = cores[waiter.core];
+    if (waiter.sched_state == SCHED_READY)
+    {
+        core.ready_lists[waiter.priority].remove(&waiter);
+    }
+    waiter.sched_state = SCHED_NONE;
+    if (core.running == &waiter)
+    {
+        core.running = nullptr;
+        prvDispatchCore(waiter.core);
+    }
+}
+
+/** Waits until the task holds the run token, must be called with sched_mutex held */
+static void prvWaitToken(std::unique_lock<std::mutex> &lock, InternalWaiter &waiter)
+{
+#if configMOCK_FIBERS
+    if (waiter.fiber)
+    {
+        /*
+         * A core only resumes the holder of its token and never an exited task.
+         * A task that got the token of another core moves to the thread of that core.
+         */
+        while (waiter.exited || waiter.sched_state != SCHED_RUNNING || cores[waiter.core].current != &waiter)
+        {
+            lock.unlock();
+            InternalFiber::suspend();
+            lock.lock();
+        }
+        return;
+    }
+#endif
+    /* A killed task goes on without the token, only to leave at its next checkpoint */
+    waiter.token_granted.wait(lock, [&waiter]()
+                              {
+                                  return waiter.sched_state == SCHED_RUNNING || waiter.exited || waiter.killed;
+                              });
+}
+
+/** Makes the task ready if needed and waits for the run token */
+static void prvAcquireToken(InternalWaiter &waiter)
+{
+    if (!waiter.is_task)
+    {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(sched_mutex);
+    prvMakeReady(waiter, false);
+    prvDispatch();
+    prvWaitToken(lock, waiter);
+}
+
+/** Gives the run token away before blocking */
+static void prvReleaseToken(InternalWaiter &waiter)
+{
+    if (!waiter.is_task)
+    {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(sched_mutex);
+#if configGENERATE_RUN_TIME_STATS
+    if (cores[waiter.core].running == &waiter)
+    {
+        waiter.voluntary_switches++;
+    }
+#endif
+    prvUnschedule(waiter);
+}
+
+#endif
+
+/** A non-zero sequence only wakes that particular wait of the waiter */
+/** @return false if the waiter was woken already or is in another wait */
+static bool prvWake(InternalWaiter &waiter, bool timeout, uint64_t sequence)
+{
+    std::unique_lock<std::mutex> lock(waiter.mutex);
+    if (waiter.woken || (sequence && sequence != waiter.sequence))
+    {
+        return false;
+    }
+    waiter.woken = true;
+    waiter.timed_out = timeout;
+#if !configMOCK_VIRTUAL_TIME
+    waiter.blocked = false;
+#else
+    if (waiter.blocked)
+    {
+        std::unique_lock<std::mutex> clock_lock(clock_mutex);
+        waiter.blocked = false;
+        prvRemoveTimedWaiter(timed_waiters, waiter);
+        if (waiter.is_task && !waiter.exited)
+        {
+            running_tasks++;
+        }
+    }
+#endif
+#if configMOCK_SCHEDULER
+    {
+        std::unique_lock<std::mutex> sched_lock(sched_mutex);
+#if configMOCK_FIBERS && !configMOCK_VIRTUAL_TIME
+        prvRemoveTimedWaiter(fiber_timeouts, waiter);
+#endif
+        prvMakeReady(waiter, false);
+        prvDispatch();
+    }
+#endif
+    waiter.cv.notify_one();
+    return true;
+}
+
+/** Remembers the priority of a task woken by the calling thread */
+static void prvNoteWoken(const InternalWaiter &waiter)
+{
+    if (waiter.is_task && (int)waiter.priority > woken_priority)
+    {
+        woken_priority = (int)waiter.priority;
+    }
+}
+
+#if configMOCK_VIRTUAL_TIME
+
+static void prvClockThread(void)
+{
+    pthread_setname_np(pthread_self(), "virtual clock");
+    InternalHost::pin_helper();
+
+    std::vector<TimedWaiter> expired;
+    std::vector<VirtualTimer> due;
+    std::unique_lock<std::mutex> lock(clock_mutex);
+    while (true)
+    {
+        clock_changed.wait(lock, []()
+                           {
+                               return running_tasks == 0 && (!timed_waiters.empty() || !virtual_timers.empty());
+                           });
+
+        /* Every task is blocked: jump to the next deadline */
+        uint64_t next = UINT64_MAX;
+        if (!timed_waiters.empty())
+        {
+            next = timed_waiters.begin()->first;
+        }
+        if (!virtual_timers.empty())
+        {
+            next = std::min(next, virtual_timers.begin()->first);
+        }
+        std::atomic<uint64_t> &now = InternalClock::virtual_ticks();
+        if (next > now.load())
+        {
+            now.store(next, std::memory_order_release);
+        }
+        const uint64_t now_ticks = now.load();
+
+        while (!timed_waiters.empty() && timed_waiters.begin()->first <= now_ticks)
+        {
+            expired.push_back(timed_waiters.begin()->second);
+            expired.back().waiter->has_deadline = false;
+            timed_waiters.erase(timed_waiters.begin());
+        }
+        while (!virtual_timers.empty() && virtual_timers.begin()->first <= now_ticks)
+        {
+            VirtualTimer timer = virtual_timers.begin()->second;
+            virtual_timers.erase(virtual_timers.begin());
+            if (timer.period)
+            {
+                virtual_timers.emplace(now_ticks + timer.period, timer);
+            }
+            due.push_back(timer);
+        }
+
+        lock.unlock();
+        for (auto &entry : expired)
+        {
+            prvWake(*entry.waiter, true, entry.sequence);
+        }
+        for (auto &timer : due)
+        {
+            if (timer.callback)
+            {
+                timer.callback();
+            }
+        }
+        expired.clear();
+        due.clear();
+        lock.lock();
+    }
+}
+
+#endif
+
+#if !configMOCK_VIRTUAL_TIME
+/** Host clock time point of a deadline in ticks */
+static std::chrono::steady_clock::time_point prvDeadlineTime(uint64_t deadline)
+{
+    const uint64_t deadline_ns = InternalClock::tick_to_time_ns(deadline);
+    const uint64_t now_ns = port_get_time_ns();
+    return std::chrono::steady_clock::now() + std::chrono::nanoseconds(deadline_ns > now_ns ? deadline_ns - now_ns : 0);
+}
+#endif
+
+/** Blocks the calling thread on the condition variable of its waiter, the waiter lock must be held */
+static bool prvWaitThread(std::unique_lock<std::mutex> &lock, InternalWaiter &waiter, uint64_t deadline)
+{
+#if configMOCK_VIRTUAL_TIME
+    /* The clock thread wakes up the timed out waiters */
+    (void)deadline;
+    while (!waiter.woken)
+    {
+        waiter.cv.wait(lock);
+    }
+    return !waiter.timed_out;
+#else
+    if (deadline == KERNEL_WAIT_FOREVER)
+    {
+        while (!waiter.woken)
+        {
+            waiter.cv.wait(lock);
+        }
+        return true;
+    }
+    const auto until = prvDeadlineTime(deadline);
+    while (!waiter.woken)
+    {
+        if (waiter.cv.wait_until(lock, until) == std::cv_status::timeout && !waiter.woken)
+        {
+            waiter.timed_out = true;
+            return false;
+        }
+    }
+    return true;
+#endif
+}
+
+#if configMOCK_FIBERS
+
+/** Switches the calling fiber off the core until it is woken, the waiter lock must be held */
+static bool prvWaitFiber(std::unique_lock<std::mutex> &lock, InternalWaiter &waiter, uint64_t deadline)
+{
+#if configMOCK_VIRTUAL_TIME
+    (void)deadline;
+#else
+    if (!waiter.woken && deadline != KERNEL_WAIT_FOREVER)
+    {
+        std::unique_lock<std::mutex> sched_lock(sched_mutex);
+        waiter.has_deadline = true;
+        waiter.deadline = deadline;
+        auto it = fiber_timeouts.emplace(deadline, TimedWaiter{&waiter, waiter.sequence});
+        if (it == fiber_timeouts.begin())
+        {
+            timeouts_changed.notify_one();
+        }
+    }
+#endif
+    /* A wake-up makes the task ready, the core resumes it when it gets the token */
+    while (!waiter.woken)
+    {
+        lock.unlock();
+        InternalFiber::suspend();
+        lock.lock();
+    }
+    return !waiter.timed_out;
+}
+
+/** Must be called with sched_mutex held */
+static bool prvOnCore(const InternalWaiter &waiter)
+{
+    for (const auto &core : cores)
+    {
+        if (core.current == &waiter)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** The stack goes away with the task, so a running fiber must get to its next switch first */
+static void prvJoinFiber(InternalWaiter &waiter)
+{
+    if (!waiter.fiber || &waiter == current_waiter_ptr)
+    {
+        return;
+    }
+    std::unique_lock<std::mutex> sched_lock(sched_mutex);
+    core_released.wait(sched_lock, [&waiter]()
+                       {
+                           return !prvOnCore(waiter);
+                       });
+}
+
+/** Host thread of an emulated core, runs the fiber that holds the run token of the core */
+static void prvCoreThread(int core_index)
+{
+    char name[16];
+    snprintf(name, sizeof(name), "core %d", core_index);
+    pthread_setname_np(pthread_self(), name);
+    InternalHost::set_core(pthread_self(), core_index);
+
+    SchedCore &core = cores[core_index];
+    std::unique_lock<std::mutex> lock(sched_mutex);
+    while (true)
+    {
+        /* A fiber that just moved here may still be leaving the thread of its previous core */
+        core.wakeup.wait(lock, [&core]()
+                         {
+                             return core.running != nullptr && !prvOnCore(*core.running);
+                         });
+        InternalWaiter *next = core.running;
+        core.current = next;
+        lock.unlock();
+
+        current_waiter_ptr = next;
+#if configGENERATE_RUN_TIME_STATS
+        const uint64_t cpu_start = InternalHost::cpu_time();
+        next->fiber->resume();
+        next->cpu_ns += InternalHost::cpu_time() - cpu_start;
+#else
+        next->fiber->resume();
+#endif
+        current_waiter_ptr = nullptr;
+
+        lock.lock();
+        core.current = nullptr;
+        core_released.notify_all();
+        for (auto &other : cores)
+        {
+            other.wakeup.notify_one();
+        }
+    }
+}
+
+#if !configMOCK_VIRTUAL_TIME
+
+/** Wakes the fibers whose wait timed out, they run when the core gets to them */
+static void prvTimeoutThread(void)
+{
+    pthread_setname_np(pthread_self(), "fiber timeouts");
+    InternalHost::pin_helper();
+
+    std::vector<TimedWaiter> expired;
+    std::unique_lock<std::mutex> lock(sched_mutex);
+    while (true)
+    {
+        if (fiber_timeouts.empty())
+        {
+            timeouts_changed.wait(lock);
+            continue;
+        }
+        const uint64_t now = InternalClock::ticks();
+        while (!fiber_timeouts.empty() && fiber_timeouts.begin()->first <= now)
+        {
+            expired.push_back(fiber_timeouts.begin()->second);
+            expired.back().waiter->has_deadline = false;
+            fiber_timeouts.erase(fiber_timeouts.begin());
+        }
+        if (expired.empty())
+        {
+            timeouts_changed.wait_until(lock, prvDeadlineTime(fiber_timeouts.begin()->first));
+            continue;
+        }
+        lock.unlock();
+        for (auto &entry : expired)
+        {
+            prvWake(*entry.waiter, true, entry.sequence);
+        }
+        expired.clear();
+        lock.lock();
+    }
+}
+
+#endif
+
+#endif
+
+/*--------------------------------------------------------------
+                      PUBLIC FUNCTIONS
+--------------------------------------------------------------*/
+
+InternalWaiter &InternalKernel::current_waiter(void)
+{
+    if (!current_waiter_ptr)
+    {
+        static thread_local InternalWaiter thread_waiter;
+        current_waiter_ptr = &thread_waiter;
+    }
+    return *current_waiter_ptr;
+}
+
+void InternalKernel::bind_waiter(InternalWaiter *waiter)
+{
+    current_waiter_ptr = waiter;
+}
+
+uint64_t InternalKernel::deadline_from_ticks(TickType_t ticks)
+{
+    if (ticks == portMAX_DELAY)
+    {
+        return KERNEL_WAIT_FOREVER;
+    }
+    return InternalClock::ticks() + ticks;
+}
+
+void InternalKernel::prepare(InternalWaiter &waiter)
+{
+    std::unique_lock<std::mutex> lock(waiter.mutex);
+    waiter.woken = false;
+    waiter.timed_out = false;
+    waiter.sequence++;
+}
+
+bool InternalKernel::block(InternalWaiter &waiter, uint64_t deadline)
+{
+    prvCheckStack(waiter);
+    std::unique_lock<std::mutex> lock(waiter.mutex);
+    if (waiter.killed)
+    {
+        /* Pairs with kill(): the caller gets to its checkpoint instead of blocking */
+        waiter.woken = true;
+    }
+#if !configMOCK_VIRTUAL_TIME
+    waiter.blocked = !waiter.woken;
+#endif
+#if configMOCK_SCHEDULER
+    if (!waiter.woken)
+    {
+        prvReleaseToken(waiter);
+    }
+#endif
+#if configMOCK_VIRTUAL_TIME
+    if (!waiter.woken)
+    {
+        std::unique_lock<std::mutex> clock_lock(clock_mutex);
+        waiter.blocked = true;
+        if (deadline != KERNEL_WAIT_FOREVER)
+        {
+            waiter.has_deadline = true;
+            waiter.deadline = deadline;
+            timed_waiters.emplace(deadline, TimedWaiter{&waiter, waiter.sequence});
+        }
+        if (waiter.is_task && !waiter.exited)
+        {
+            running_tasks--;
+        }
+        prvNotifyClock();
+    }
+#endif
+#if configMOCK_FIBERS
+    const bool woken = waiter.fiber ? prvWaitFiber(lock, waiter, deadline) : prvWaitThread(lock, waiter, deadline);
+#else
+    const bool woken = prvWaitThread(lock, waiter, deadline);
+#endif
+#if !configMOCK_VIRTUAL_TIME
+    /* A timeout of the host wait does not go through prvWake() */
+    waiter.blocked = false;
+#endif
+    lock.unlock();
+#if configMOCK_SCHEDULER
+    /* Ready again, run when the scheduler says so */
+    prvAcquireToken(waiter);
+#endif
+    return woken;
+}
+
+void InternalKernel::wake(InternalWaiter &waiter)
+{
+    if (prvWake(waiter, false, 0))
+    {
+        prvNoteWoken(waiter);
+    }
+}
+
+void InternalKernel::wake(InternalWaiter &waiter, uint64_t sequence)
+{
+    if (prvWake(waiter, false, sequence))
+    {
+        prvNoteWoken(waiter);
+    }
+}
+
+bool InternalKernel::blocked(InternalWaiter &waiter)
+{
+    std::unique_lock<std::mutex> lock(waiter.mutex);
+    return waiter.blocked;
+}
+
+int InternalKernel::collect_woken(void)
+{
+    const int outer = woken_priority;
+    woken_priority = -1;
+    return outer;
+}
+
+void InternalKernel::end_woken(int outer)
+{
+    woken_priority = std::max(woken_priority, outer);
+}
+
+bool InternalKernel::woke_higher_priority(void)
+{
+    const InternalWaiter &self = current_waiter();
+    return woken_priority >= 0 && (!self.is_task || (UBaseType_t)woken_priority > self.priority);
+}
+
+void InternalKernel::suspend(InternalWaiter &waiter)
+{
+    waiter.suspended = true;
+    if (&waiter == current_waiter_ptr)
+    {
+        checkpoint();
+    }
+}
+
+bool InternalKernel::resume(InternalWaiter &waiter)
+{
+    if (!waiter.suspended.exchange(false))
+    {
+        return false;
+    }
+    /* Pairs with checkpoint(): either the task sees the flag cleared or we see it parked */
+    const uint64_t sequence = waiter.parked;
+    if (sequence)
+    {
+        prvWake(waiter, false, sequence);
+    }
+    return true;
+}
+
+void InternalKernel::checkpoint(void)
+{
+    InternalWaiter &waiter = current_waiter();
+    while (waiter.interrupted())
+    {
+        if (waiter.killed)
+        {
+            exit_task();
+        }
+        prepare(waiter);
+        waiter.parked = waiter.sequence;
+        if (!waiter.interrupted())
+        {
+            break;
+        }
+        block(waiter, KERNEL_WAIT_FOREVER);
+    }
+    waiter.parked = 0;
+}
+
+void InternalKernel::kill(InternalWaiter &waiter)
+{
+    waiter.killed = true;
+#if configMOCK_FIBERS
+    /* A fiber only leaves when a core runs it, so it must not wait behind busy tasks */
+    set_priority(waiter, configMAX_PRIORITIES - 1);
+#endif
+    prvWake(waiter, false, 0);
+#if configMOCK_SCHEDULER
+    std::unique_lock<std::mutex> lock(sched_mutex);
+    waiter.token_granted.notify_one();
+#if configMOCK_FIBERS
+    prvDispatch();
+#endif
+#endif
+}
+
+void InternalKernel::join(InternalWaiter &waiter)
+{
+#if configMOCK_FIBERS
+    std::unique_lock<std::mutex> sched_lock(sched_mutex);
+    core_released.wait(sched_lock, [&waiter]()
+                       {
+                           return waiter.exited && !prvOnCore(waiter);
+                       });
+#else
+    (void)waiter;
+#endif
+}
+
+void InternalKernel::exit_task(void)
+{
+    task_exited(current_waiter());
+#if configMOCK_FIBERS
+    /* The core never resumes an exited fiber */
+    while (true)
+    {
+        InternalFiber::suspend();
+    }
+#else
+    InternalThreadPool::exit();
+#endif
+}
+
+void InternalKernel::delay(TickType_t ticks)
+{
+    if (ticks == 0)
+    {
+        yield(true);
+        return;
+    }
+    delay_until(deadline_from_ticks(ticks));
+}
+
+void InternalKernel::delay_until(uint64_t deadline)
+{
+    InternalWaiter &waiter = current_waiter();
+    /* Only a timeout ends a delay */
+    bool woken;
+    do
+    {
+        prepare(waiter);
+        woken = block(waiter, deadline);
+        checkpoint();
+    } while (woken && InternalClock::ticks() < deadline);
+}
+
+void InternalKernel::task_started(InternalWaiter &waiter, UBaseType_t priority, BaseType_t core_id)
+{
+    waiter.is_task = true;
+    waiter.priority = std::min<UBaseType_t>(priority, configMAX_PRIORITIES - 1);
+    waiter.affinity = (core_id >= 0 && core_id < configNUM_CORES) ? (int)core_id : -1;
+#if configMOCK_VIRTUAL_TIME
+    {
+        std::unique_lock<std::mutex> clock_lock(clock_mutex);
+        running_tasks++;
+    }
+#endif
+#if configMOCK_SCHEDULER
+    const InternalWaiter &creator = current_waiter();
+    std::unique_lock<std::mutex> sched_lock(sched_mutex);
+    /* Unpinned tasks start on the core of their creator */
+    waiter.core = (waiter.affinity >= 0) ? waiter.affinity : (creator.is_task ? creator.core : 0);
+    prvMakeReady(waiter, false);
+    prvDispatch();
+#else
+    waiter.core = (waiter.affinity >= 0) ? waiter.affinity : 0;
+#endif
+}
+
+void InternalKernel::task_entry(InternalWaiter &waiter)
+{
+#if configMOCK_SCHEDULER
+    prvAcquireToken(waiter);
+#else
+    (void)waiter;
+#endif
+    /* The task may have been suspended before it ran */
+    checkpoint();
+}
+
+void InternalKernel::set_priority(InternalWaiter &waiter, UBaseType_t priority)
+{
+    priority = std::min<UBaseType_t>(priority, configMAX_PRIORITIES - 1);
+#if configMOCK_SCHEDULER
+    std::unique_lock<std::mutex> sched_lock(sched_mutex);
+    if (waiter.sched_state == SCHED_READY)
+    {
+        SchedCore &core = cores[waiter.core];
+        core.ready_lists[waiter.priority].remove(&waiter);
+        waiter.priority = priority;
+        core.ready_lists[priority].push_back(&waiter);
+        return;
+    }
+#endif
+    waiter.priority = priority;
+}
+
+void InternalKernel::task_exited(InternalWaiter &waiter)
+{
+    std::unique_lock<std::mutex> lock(waiter.mutex);
+    if (waiter.exited)
+    {
+#if configMOCK_FIBERS
+        lock.unlock();
+        prvJoinFiber(waiter);
+#endif
+        return;
+    }
+#if configMOCK_SCHEDULER
+    {
+        std::unique_lock<std::mutex> sched_lock(sched_mutex);
+        waiter.exited = true;
+        prvUnschedule(waiter);
+#if configMOCK_FIBERS && !configMOCK_VIRTUAL_TIME
+        prvRemoveTimedWaiter(fiber_timeouts, waiter);
+#endif
+        waiter.token_granted.notify_one();
+    }
+#else
+    waiter.exited = true;
+#endif
+#if configMOCK_VIRTUAL_TIME
+    {
+        std::unique_lock<std::mutex> clock_lock(clock_mutex);
+        prvRemoveTimedWaiter(timed_waiters, waiter);
+        if (!waiter.blocked)
+        {
+            running_tasks--;
+            prvNotifyClock();
+        }
+    }
+#endif
+#if configMOCK_FIBERS
+    lock.unlock();
+    prvJoinFiber(waiter);
+#endif
+}
+
+void InternalKernel::start(void)
+{
+#if configMOCK_VIRTUAL_TIME
+    {
+        std::unique_lock<std::mutex> clock_lock(clock_mutex);
+        if (!clock_started)
+        {
+            clock_started = true;
+            std::thread(prvClockThread).detach();
+        }
+    }
+#endif
+#if configMOCK_FIBERS
+    {
+        std::unique_lock<std::mutex> sched_lock(sched_mutex);
+        if (!kernel_started)
+        {
+            for (int core_index = 0; core_index < configNUM_CORES; core_index++)
+            {
+                std::thread(prvCoreThread, core_index).detach();
+            }
+#if !configMOCK_VIRTUAL_TIME
+            std::thread(prvTimeoutThread).detach();
+#endif
+        }
+    }
+#endif
+#if configMOCK_SCHEDULER
+    std::unique_lock<std::mutex> sched_lock(sched_mutex);
+    kernel_started = true;
+    prvDispatch();
+#else
+    kernel_started = true;
+#endif
+}
+
+BaseType_t InternalKernel::core_id(void)
+{
+    InternalWaiter &waiter = current_waiter();
+#if configMOCK_SCHEDULER
+    /* Unpinned tasks move between cores when they are not running */
+    std::unique_lock<std::mutex> lock(sched_mutex);
+#endif
+    return waiter.core;
+}
+
+BaseType_t InternalKernel::scheduler_state(void)
+{
+    if (!kernel_started)
+    {
+        return taskSCHEDULER_NOT_STARTED;
+    }
+    return kernel_suspended ? taskSCHEDULER_SUSPENDED : taskSCHEDULER_RUNNING;
+}
+
+void InternalKernel::yield(bool force)
+{
+    prvCheckStack(current_waiter());
+    checkpoint();
+#if configMOCK_SCHEDULER
+    InternalWaiter &waiter = current_waiter();
+    if (!waiter.is_task || kernel_suspended)
+    {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(sched_mutex);
+    SchedCore &core = cores[waiter.core];
+    if (core.running != &waiter)
+    {
+#if configMOCK_FIBERS
+        /* A fiber deleted by another thread leaves the core here */
+        if (waiter.exited)
+        {
+            prvWaitToken(lock, waiter);
+        }
+#endif
+        return;
+    }
+#if configMOCK_FIBERS
+    if (core.current != &waiter)
+    {
+        /* Got the token of another core while still on the thread of the previous one */
+        prvWaitToken(lock, waiter);
+        return;
+    }
+#endif
+    const int top = prvTopPriorityFor(waiter.core);
+    if (top < 0 || (UBaseType_t)top < waiter.priority)
+    {
+        return;
+    }
+    const bool preempted = (UBaseType_t)top > waiter.priority;
+    const bool slice_over = configUSE_TIME_SLICING && InternalClock::ticks() != waiter.slice_start;
+    if (!preempted && !force && !slice_over)
+    {
+        return;
+    }
+#if configGENERATE_RUN_TIME_STATS
+    if (force)
+    {
+        waiter.voluntary_switches++;
+    }
+    else
+    {
+        waiter.involuntary_switches++;
+    }
+#endif
+    core.running = nullptr;
+    waiter.sched_state = SCHED_NONE;
+    /* A preempted task resumes before the other tasks of its priority */
+    prvMakeReady(waiter, preempted);
+    prvDispatch();
+    prvWaitToken(lock, waiter);
+#else
+    if (force)
+    {
+        std::this_thread::yield();
+    }
+#endif
+}
+
+void InternalKernel::suspend_all(void)
+{
+    kernel_suspended++;
+}
+
+bool InternalKernel::resume_all(void)
+{
+    if (kernel_suspended == 0 || --kernel_suspended != 0)
+    {
+        return false;
+    }
+#if configMOCK_SCHEDULER
+    InternalWaiter &waiter = current_waiter();
+    {
+        std::unique_lock<std::mutex> lock(sched_mutex);
+        if (cores[waiter.core].running != &waiter)
+        {
+            return false;
+        }
+        const int top = prvTopPriorityFor(waiter.core);
+        if (top < 0 || (UBaseType_t)top <= waiter.priority)
+        {
+            return false;
+        }
+    }
+    yield();
+    return true;
+#else
+    return false;
+#endif
+}
+
+InternalKernel::timer_id InternalKernel::add_timer(uint64_t delay_ticks, timer_callback_t callback, uint64_t period_ticks)
+{
+#if configMOCK_VIRTUAL_TIME
+    std::unique_lock<std::mutex> clock_lock(clock_mutex);
+    timer_id id = next_timer_id++;
+    virtual_timers.emplace(InternalClock::ticks() + std::max<uint64_t>(delay_ticks, 1),
+                           VirtualTimer{id, callback, period_ticks});
+    prvNotifyClock();
+    return id;
+#else
+    (void)delay_ticks;
+    (void)callback;
+    (void)period_ticks;
+    return 0;
+#endif
+}
+
+void InternalKernel::remove_timer(timer_id id)
+{
+#if configMOCK_VIRTUAL_TIME
+    std::unique_lock<std::mutex> clock_lock(clock_mutex);
+    for (auto it = virtual_timers.begin(); it != virtual_timers.end(); ++it)
+    {
+        if (it->second.id == id)
+        {
+            virtual_timers.erase(it);
+            break;
+        }
+    }
+#else
+    (void)id;
+#endif
+}
@@ -0,0 +1,66 @@
+/**
+ * @file mock_mirror.cpp
+ * @author Stanislav Karpikov
+ * @brief Mock layer for FreeRTOS, ring storage mapped twice for wrap-free access
+ */
+
+/*--------------------------------------------------------------
+                       INCLUDES
+--------------------------------------------------------------*/
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include "internal_mirror.h"
+
+/*--------------------------------------------------------------
+                      PUBLIC FUNCTIONS
+--------------------------------------------------------------*/
+
+InternalMirror::~InternalMirror()
+{
+    if (base_)
+    {
+        munmap(base_, 2 * size_);
+    }
+}
+
+bool InternalMirror::map(size_t size)
+{
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if (base_ || size == 0 || size % page != 0)
+    {
+        return false;
+    }
+    /* The pages live in an anonymous file, both views share them */
+    const int fd = memfd_create("freertos-mock-ring", MFD_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    void *reserved = MAP_FAILED;
+    if (ftruncate(fd, (off_t)size) == 0)
+    {
+        /* Reserves the address range for both views first, then maps over it */
+        reserved = mmap(nullptr, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    }
+    bool mapped = false;
+    if (reserved != MAP_FAILED)
+    {
+        uint8_t *first = static_cast<uint8_t *>(reserved);
+        mapped = mmap(first, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED &&
+                 mmap(first + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED;
+        if (!mapped)
+        {
+            munmap(reserved, 2 * size);
+        }
+    }
+    /* The mappings keep the file alive */
+    close(fd);
+    if (!mapped)
+    {
+        return false;
+    }
+    base_ = static_cast<uint8_t *>(reserved);
+    size_ = size;
+    return true;
+}
@@ -8,10 +8,15 @@
                        INCLUDES
 --------------------------------------------------------------*/
 
-#include <condition_variable>
-#include <deque>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <mutex>
+#include <new>
 #include <cstring>
+#include <vector>
+#include "internal_kernel.h"
 
 extern "C"
 {
@@ -20,124 +25,605 @@ extern "C"
     #include "semphr.h"
 }
 
+/*--------------------------------------------------------------
+                       PRIVATE DEFINES
+--------------------------------------------------------------*/
+
+/*
+ * configMOCK_QUEUE_MODE selects how items pass through queues of more than
+ * one item. The lock-free modes take the queue mutex only to block on a full
+ * or empty queue, they do not support xQueueSendToFront().
+ */
+#define MOCK_QUEUE_LOCKED 0 /*< A mutex around every operation */
+#define MOCK_QUEUE_SPSC 1   /*< Lock-free, at most one sender and one receiver at a time */
+#define MOCK_QUEUE_MPMC 2   /*< Lock-free, any number of senders and receivers */
+
+#ifndef configMOCK_QUEUE_MODE
+#define configMOCK_QUEUE_MODE MOCK_QUEUE_LOCKED
+#endif
+
+/* Senders and receivers of a lock-free queue keep their positions on separate cache lines */
+#define CACHE_LINE_SIZE 64
+
+/* ucQueueType of a queue set, queueQUEUE_TYPE_SET has the value of queueQUEUE_TYPE_BASE */
+#define QUEUE_TYPE_SET ((uint8_t)0xFFU)
+
 /*--------------------------------------------------------------
                        PRIVATE TYPES
 --------------------------------------------------------------*/
 
-using namespace std::chrono;
+/** Counts a task in a lock-free wait for as long as it is there */
+class Blocked
+{
+public:
+    explicit Blocked(std::atomic<unsigned> &count) : count_(count)
+    {
+        /*
+         * Both sides modify the count, so either this reads the update of the
+         * waking side and sees its item, or the waking side sees the task
+         */
+        count_.fetch_add(1, std::memory_order_acq_rel);
+    }
+    ~Blocked()
+    {
+        count_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<unsigned> &count_;
+};
 
-/** Dequeue implementation with timeout */
+#if configMOCK_QUEUE_MODE == MOCK_QUEUE_SPSC
+/**
+ * Counts the tasks inside one side of a lock-free queue, a second one aborts.
+ * The count also orders the positions cached by a task for the next one of the same side.
+ */
+class InFlight
+{
+public:
+    InFlight(std::atomic<unsigned> &count, const char *side) : count_(count)
+    {
+        if (count_.fetch_add(1, std::memory_order_acquire) != 0)
+        {
+            printf("Concurrent %s on one queue, MOCK_QUEUE_SPSC allows one at a time, see configMOCK_QUEUE_MODE\n", side);
+            abort();
+        }
+    }
+    ~InFlight()
+    {
+        count_.fetch_sub(1, std::memory_order_release);
+    }
+
+private:
+    std::atomic<unsigned> &count_;
+};
+#endif
+
+/**
+ * Dequeue implementation with timeout. Items are copied in place into a ring
+ * of maxElements slots that is allocated once, or given by the application
+ * for a static queue. The back is the oldest item.
+ */
 class TimedDeque
 {
 public:
-    explicit TimedDeque(size_t maxElements, size_t elementSize)
-        : maxElements_(maxElements), elementSize_(elementSize) {}
+    explicit TimedDeque(size_t maxElements, size_t elementSize, uint8_t *storage = nullptr)
+        : maxElements_(maxElements), elementSize_(elementSize)
+#if configMOCK_QUEUE_MODE != MOCK_QUEUE_LOCKED
+          ,
+          /* xQueueOverwrite() is only allowed on queues of one item, they stay locked for it */
+          lockFree_(maxElements > 1)
+#endif
+    {
+        storage_ = storage;
+#if configMOCK_QUEUE_MODE == MOCK_QUEUE_MPMC
+        if (lockFree_)
+        {
+            sequence_.reset(new std::atomic<size_t>[maxElements_]);
+            for (size_t i = 0; i < maxElements_; i++)
+            {
+                sequence_[i].store(i, std::memory_order_relaxed);
+            }
+        }
+#endif
+    }
 
-    bool PushFront(const void *element, uint32_t timeoutMs)
+    bool PushFront(const void *element, TickType_t ticks)
     {
+#if configMOCK_QUEUE_MODE != MOCK_QUEUE_LOCKED
+        if (lockFree_)
+        {
+            return LockFreePush(element, ticks);
+        }
+#endif
         std::unique_lock<std::mutex> lock(mutex_);
-        if (!condFull_.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this]()
-                                { return deque_.size() < maxElements_; }))
+        if (!Send(lock, element, false, ticks))
         {
             printf("Timeout occurred while waiting to add element to the front of the deque.");
             return false;
         }
-        void *buffer = AllocateBuffer();
-        std::memcpy(buffer, element, elementSize_);
-        deque_.push_front(buffer);
-        condEmpty_.notify_all();
         return true;
     }
 
-    bool PushBack(const void *element, uint32_t timeoutMs)
+    bool PushBack(const void *element, TickType_t ticks)
     {
+#if configMOCK_QUEUE_MODE != MOCK_QUEUE_LOCKED
+        if (lockFree_)
+        {
+            Unsupported("xQueueSendToFront");
+        }
+#endif
         std::unique_lock<std::mutex> lock(mutex_);
-        if (!condFull_.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this]()
-                                { return deque_.size() < maxElements_; }))
+        if (!Send(lock, element, true, ticks))
         {
             printf("Timeout occurred while waiting to add element to the back of the deque.");
             return false;
         }
-        void *buffer = AllocateBuffer();
-        std::memcpy(buffer, element, elementSize_);
-        deque_.push_back(buffer);
-        condEmpty_.notify_all();
         return true;
     }
 
-    bool PopFront(void *destination, uint32_t timeoutMs)
+    bool PopFront(void *destination, TickType_t ticks)
     {
-        std::unique_lock<std::mutex> lock(mutex_);
-        if (!condEmpty_.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this]()
-                                 { return !deque_.empty(); }))
+#if configMOCK_QUEUE_MODE != MOCK_QUEUE_LOCKED
+        if (lockFree_)
         {
-            // Timeout occurred
-            //            printf("Timeout occurred while waiting to pop element from the front of the deque.");
-            return false;
+            Unsupported("PopFront");
         }
-        void *frontBuffer = deque_.front();
-        std::memcpy(destination, frontBuffer, elementSize_);
-        FreeBuffer(frontBuffer);
-        deque_.pop_front();
-        condFull_.notify_all();
-        return true;
+#endif
+        std::unique_lock<std::mutex> lock(mutex_);
+        return Receive(lock, destination, true, ticks);
     }
 
-    bool PopBack(void *destination, uint32_t timeoutMs)
+    bool PopBack(void *destination, TickType_t ticks)
     {
+#if configMOCK_QUEUE_MODE != MOCK_QUEUE_LOCKED
+        if (lockFree_)
+        {
+            return LockFreePop(destination, ticks);
+        }
+#endif
         std::unique_lock<std::mutex> lock(mutex_);
-        if (!condEmpty_.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this]()
-                                 { return !deque_.empty(); }))
+        if (!Receive(lock, destination, false, ticks))
         {
             printf("Timeout occurred while waiting to pop element from the back of the deque.");
             return false;
         }
-        void *backBuffer = deque_.back();
-        std::memcpy(destination, backBuffer, elementSize_);
-        FreeBuffer(backBuffer);
-        deque_.pop_back();
-        condFull_.notify_all();
         return true;
     }
 
-    bool OverwriteLast(const void *element, uint32_t timeoutMs)
+    /** Replaces the item next to be received, an empty queue gets it like from xQueueSend() */
+    bool OverwriteLast(const void *element, TickType_t ticks)
     {
+#if configMOCK_QUEUE_MODE != MOCK_QUEUE_LOCKED
+        if (lockFree_)
+        {
+            Unsupported("xQueueOverwrite");
+        }
+#endif
         std::unique_lock<std::mutex> lock(mutex_);
-        if (!condEmpty_.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this]()
-                                 { return !deque_.empty(); }))
+        if (count_ == 0)
         {
-            printf("Timeout occurred while waiting to overwrite the last element in the deque.");
-            return false;
+            return Send(lock, element, false, ticks);
         }
-        void *backBuffer = deque_.back();
-        std::memcpy(backBuffer, element, elementSize_);
-        condEmpty_.notify_all();
+        Store(back_, element);
         return true;
     }
 
     int number_of_elements(void)
     {
+#if configMOCK_QUEUE_MODE != MOCK_QUEUE_LOCKED
+        if (lockFree_)
+        {
+            /* Only a snapshot, the head may pass the tail read before it */
+            const size_t tail = tail_.position.load(std::memory_order_acquire);
+            const size_t head = head_.position.load(std::memory_order_acquire);
+            return (tail > head ? tail - head : 0);
+        }
+#endif
         std::unique_lock<std::mutex> lock(mutex_);
-        return deque_.size();
+        return count_;
+    }
+
+    /** Ring of the items, given to the constructor */
+    uint8_t *storage(void) const
+    {
+        return storage_;
     }
 
 private:
-    std::deque<void *> deque_;
+    /** Application storage of a static queue, allocated with the queue otherwise */
+    uint8_t *storage_;
     const size_t maxElements_;
     const size_t elementSize_;
+    /** Slot of the oldest item and the number of items after it, 32 bits keep a static queue in its StaticQueue_t */
+    uint32_t back_ = 0;
+    uint32_t count_ = 0;
     std::mutex mutex_;
-    std::condition_variable condFull_;
-    std::condition_variable condEmpty_;
+    /** Tasks blocked on a locked queue by priority, the other side copies their items and wakes them one by one */
+    WaitList senders_;
+    WaitList receivers_;
+
+#if configMOCK_QUEUE_MODE != MOCK_QUEUE_LOCKED
+    /* The lock-free state is left out of the locked mode, so a static queue fits its StaticQueue_t */
+    /** Tasks blocked on a lock-free queue, they copy their items themselves */
+    InternalCondition condFull_;
+    InternalCondition condEmpty_;
+
+    /** Position of one side of a lock-free queue, it only grows */
+    struct Index
+    {
+        std::atomic<size_t> position{0};
+        /** SPSC: last position of the other side seen by this side */
+        size_t cached = 0;
+        /** SPSC: tasks inside TryPush() or TryPop() of this side */
+        std::atomic<unsigned> inFlight{0};
+        char padding[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>) - sizeof(size_t) - sizeof(std::atomic<unsigned>)];
+    };
+
+    const bool lockFree_;
+    /** Items are received at the head and sent at the tail */
+    Index head_;
+    Index tail_;
+    /** Tasks inside wait() of condFull_ and condEmpty_, the others do not notify if there are none */
+    std::atomic<unsigned> blockedSenders_{0};
+    std::atomic<unsigned> blockedReceivers_{0};
+    /** MPMC: position for which a slot can be written, or read one lap later */
+    std::unique_ptr<std::atomic<size_t>[]> sequence_;
+
+    [[noreturn]] void Unsupported(const char *operation)
+    {
+        printf("%s is not supported by the lock-free queues, see configMOCK_QUEUE_MODE\n", operation);
+        abort();
+    }
+
+    bool LockFreePush(const void *element, TickType_t ticks)
+    {
+        if (!TryPush(element))
+        {
+            if (ticks == 0)
+            {
+                return false;
+            }
+            std::unique_lock<std::mutex> lock(mutex_);
+            Blocked blocked(blockedSenders_);
+            if (!condFull_.wait(lock, ticks, [this, element]()
+                                { return TryPush(element); }))
+            {
+                return false;
+            }
+        }
+        NotifyBlocked(blockedReceivers_, condEmpty_);
+        return true;
+    }
 
-    void *AllocateBuffer()
+    bool LockFreePop(void *destination, TickType_t ticks)
     {
-        void *buffer = new char[elementSize_];
-        return buffer;
+        if (!TryPop(destination))
+        {
+            if (ticks == 0)
+            {
+                return false;
+            }
+            std::unique_lock<std::mutex> lock(mutex_);
+            Blocked blocked(blockedReceivers_);
+            if (!condEmpty_.wait(lock, ticks, [this, destination]()
+                                 { return TryPop(destination); }))
+            {
+                return false;
+            }
+        }
+        NotifyBlocked(blockedSenders_, condFull_);
+        return true;
     }
 
-    void FreeBuffer(void *buffer)
+    void NotifyBlocked(std::atomic<unsigned> &blocked, InternalCondition &condition)
     {
-        delete[] static_cast<char *>(buffer);
+        if (blocked.fetch_add(0, std::memory_order_acq_rel))
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condition.notify_one();
+        }
+    }
+
+#if configMOCK_QUEUE_MODE == MOCK_QUEUE_MPMC
+    /* Bounded MPMC queue of D. Vyukov: a slot belongs to whoever moves the position past it */
+    bool TryPush(const void *element)
+    {
+        size_t position = tail_.position.load(std::memory_order_relaxed);
+        while (true)
+        {
+            const size_t slot = position % maxElements_;
+            const intptr_t lag = (intptr_t)(sequence_[slot].load(std::memory_order_acquire) - position);
+            if (lag == 0)
+            {
+                if (tail_.position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    Store(slot, element);
+                    sequence_[slot].store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (lag < 0)
+            {
+                /* The slot still holds the item of the previous lap */
+                return false;
+            }
+            else
+            {
+                position = tail_.position.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool TryPop(void *destination)
+    {
+        size_t position = head_.position.load(std::memory_order_relaxed);
+        while (true)
+        {
+            const size_t slot = position % maxElements_;
+            const intptr_t lag = (intptr_t)(sequence_[slot].load(std::memory_order_acquire) - (position + 1));
+            if (lag == 0)
+            {
+                if (head_.position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    Load(slot, destination);
+                    sequence_[slot].store(position + maxElements_, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (lag < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = head_.position.load(std::memory_order_relaxed);
+            }
+        }
+    }
+#else
+    /* Single producer and consumer, each side only writes its own position */
+    bool TryPush(const void *element)
+    {
+        InFlight sender(tail_.inFlight, "senders");
+        const size_t position = tail_.position.load(std::memory_order_relaxed);
+        if (position - tail_.cached == maxElements_)
+        {
+            tail_.cached = head_.position.load(std::memory_order_acquire);
+            if (position - tail_.cached == maxElements_)
+            {
+                return false;
+            }
+        }
+        Store(position % maxElements_, element);
+        tail_.position.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool TryPop(void *destination)
+    {
+        InFlight receiver(head_.inFlight, "receivers");
+        const size_t position = head_.position.load(std::memory_order_relaxed);
+        if (position == head_.cached)
+        {
+            head_.cached = tail_.position.load(std::memory_order_acquire);
+            if (position == head_.cached)
+            {
+                return false;
+            }
+        }
+        Load(position % maxElements_, destination);
+        head_.position.store(position + 1, std::memory_order_release);
+        return true;
+    }
+#endif
+#endif /* configMOCK_QUEUE_MODE != MOCK_QUEUE_LOCKED */
+
+    /** Sends the item, blocks for up to ticks while the queue is full */
+    bool Send(std::unique_lock<std::mutex> &lock, const void *element, bool toFront, TickType_t ticks)
+    {
+        const uint64_t deadline = (ticks ? InternalKernel::deadline_from_ticks(ticks) : 0);
+        while (true)
+        {
+            if (TrySend(element, toFront))
+            {
+                return true;
+            }
+            if (ticks == 0 || Expired(deadline))
+            {
+                return false;
+            }
+            if (Block(lock, senders_, const_cast<void *>(element), toFront, deadline))
+            {
+                return true;
+            }
+        }
+    }
+
+    /** Receives the oldest item (the newest one if newest is set), blocks for up to ticks while the queue is empty */
+    bool Receive(std::unique_lock<std::mutex> &lock, void *destination, bool newest, TickType_t ticks)
+    {
+        const uint64_t deadline = (ticks ? InternalKernel::deadline_from_ticks(ticks) : 0);
+        while (true)
+        {
+            if (TryReceive(destination, newest))
+            {
+                return true;
+            }
+            if (ticks == 0 || Expired(deadline))
+            {
+                return false;
+            }
+            if (Block(lock, receivers_, destination, false, deadline))
+            {
+                return true;
+            }
+        }
+    }
+
+    /** Copies the item into the buffer of a blocked receiver, or into the ring if there is room */
+    bool TrySend(const void *element, bool toFront)
+    {
+        if (count_ == 0)
+        {
+            InternalWaiter *receiver = TakeWaiter(receivers_);
+            if (receiver)
+            {
+                Copy(receiver->transfer.buffer, element);
+                Complete(receiver);
+                return true;
+            }
+        }
+        if (count_ == maxElements_)
+        {
+            return false;
+        }
+        Put(element, toFront);
+        return true;
+    }
+
+    /** Copies an item out of the ring, the slot it frees takes the item of the first blocked sender */
+    bool TryReceive(void *destination, bool newest)
+    {
+        InternalWaiter *sender;
+        if (count_ == 0)
+        {
+            /* Only a queue of no slots keeps senders blocked while it is empty */
+            sender = TakeWaiter(senders_);
+            if (!sender)
+            {
+                return false;
+            }
+            Copy(destination, sender->transfer.buffer);
+            Complete(sender);
+            return true;
+        }
+        if (newest)
+        {
+            count_--;
+            Load(Slot(count_), destination);
+        }
+        else
+        {
+            Load(back_, destination);
+            back_ = (uint32_t)Slot(1);
+            count_--;
+        }
+        sender = TakeWaiter(senders_);
+        if (sender)
+        {
+            Put(sender->transfer.buffer, sender->transfer.to_front);
+            Complete(sender);
+        }
+        return true;
+    }
+
+    /** xQueueSendToFront() puts the item at the back of the ring, it is received next */
+    void Put(const void *element, bool toFront)
+    {
+        if (toFront)
+        {
+            back_ = (uint32_t)(back_ == 0 ? maxElements_ : back_) - 1;
+            Store(back_, element);
+        }
+        else
+        {
+            Store(Slot(count_), element);
+        }
+        count_++;
+    }
+
+    /**
+     * Blocks the calling task on the list until the other side has copied its
+     * item, the deadline passes or the task is suspended or deleted.
+     * @return true if the item was copied
+     */
+    bool Block(std::unique_lock<std::mutex> &lock, WaitList &list, void *buffer, bool toFront, uint64_t deadline)
+    {
+        InternalWaiter &waiter = InternalKernel::current_waiter();
+        InternalKernel::prepare(waiter);
+        waiter.transfer.buffer = buffer;
+        waiter.transfer.to_front = toFront;
+        waiter.transfer.done = false;
+        list.push_by_priority(&waiter);
+        lock.unlock();
+        InternalKernel::block(waiter, deadline);
+        lock.lock();
+        list.remove(&waiter);
+        if (waiter.transfer.done)
+        {
+            return true;
+        }
+        if (waiter.interrupted())
+        {
+            lock.unlock();
+            InternalKernel::checkpoint();
+            lock.lock();
+        }
+        return false;
+    }
+
+    /**
+     * First blocked task of the list that is neither suspended nor being deleted, taken off the list.
+     * A suspended task skipped on the way is woken to park, it tries again once it is resumed.
+     */
+    static InternalWaiter *TakeWaiter(WaitList &list)
+    {
+        InternalWaiter *waiter = list.front();
+        while (waiter)
+        {
+            InternalWaiter *next = WaitList::next(waiter);
+            if (!waiter->interrupted())
+            {
+                list.remove(waiter);
+                return waiter;
+            }
+            if (!waiter->killed)
+            {
+                list.remove(waiter);
+                InternalKernel::wake(*waiter);
+            }
+            waiter = next;
+        }
+        return nullptr;
+    }
+
+    /** Wakes a blocked task whose item has been copied */
+    static void Complete(InternalWaiter *waiter)
+    {
+        waiter->transfer.done = true;
+        InternalKernel::wake(*waiter);
+    }
+
+    static bool Expired(uint64_t deadline)
+    {
+        return deadline != KERNEL_WAIT_FOREVER && InternalClock::ticks() >= deadline;
+    }
+
+    void Copy(void *destination, const void *source) const
+    {
+        /* Zero sized items may come with no storage at all */
+        if (elementSize_)
+        {
+            std::memcpy(destination, source, elementSize_);
+        }
+    }
+
+    /** Slot of the item offset places from the back */
+    size_t Slot(size_t offset) const
+    {
+        size_t slot = back_ + offset;
+        return (slot >= maxElements_ ? slot - maxElements_ : slot);
+    }
+
+    void Store(size_t slot, const void *element)
+    {
+        Copy(storage_ + slot * elementSize_, element);
+    }
+
+    void Load(size_t slot, void *destination) const
+    {
+        Copy(destination, storage_ + slot * elementSize_);
     }
 };
 
@@ -147,139 +633,576 @@ typedef enum
     QUEUE_STATIC
 } queue_type_t;
 
+/**
+ * Counting and binary semaphore on one atomic count of available items. A
+ * give, and a take that does not have to block, is a compare-and-swap of the
+ * count, the mutex is only taken to block on a zero count and to wake such a
+ * task.
+ */
 class CountingSemaphore
 {
+public:
+    CountingSemaphore(uint32_t max_count, uint32_t initial_count) : count_(initial_count),
+                                                                    maxCount_(max_count)
+    {
+    }
+
+    /** @return false if the count is at its maximum already */
+    bool release(void)
+    {
+        uint32_t count = count_.load(std::memory_order_relaxed);
+        do
+        {
+            if (count == maxCount_)
+            {
+                return false;
+            }
+        } while (!count_.compare_exchange_weak(count, count + 1, std::memory_order_release, std::memory_order_relaxed));
+        if (blocked_.fetch_add(0, std::memory_order_acq_rel))
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condition_.notify_one();
+        }
+        return true;
+    }
+
+    bool acquire(TickType_t ticks)
+    {
+        if (TryAcquire())
+        {
+            return true;
+        }
+        if (ticks == 0)
+        {
+            return false;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        Blocked blocked(blocked_);
+        /* The deadline is fixed once, a task that loses the count to another one waits for the rest of it */
+        return condition_.wait(lock, ticks, [this]()
+                               { return TryAcquire(); });
+    }
+
+    uint32_t available(void)
+    {
+        return count_.load(std::memory_order_acquire);
+    }
+
+private:
+    std::atomic<uint32_t> count_;
+    const uint32_t maxCount_;
+    /** Tasks inside wait() of condition_, a give does not take the mutex if there are none */
+    std::atomic<unsigned> blocked_{0};
     std::mutex mutex_;
-    std::condition_variable condition_;
-    uint32_t _count;
-    uint32_t _max_count;
+    InternalCondition condition_;
+
+    bool TryAcquire(void)
+    {
+        uint32_t count = count_.load(std::memory_order_relaxed);
+        while (count)
+        {
+            if (count_.compare_exchange_weak(count, count - 1, std::memory_order_acquire, std::memory_order_relaxed))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+/**
+ * Mutex with a timeout, recursive mutexes may be locked again by the owner.
+ * A task that has to wait lends its priority to the holder until the holder
+ * gives the mutex back or the wait times out, as the kernel does.
+ */
+class TimedMutex
+{
+    std::mutex mutex_;
+    InternalCondition released_;
+    const bool recursive_;
+    InternalWaiter *owner_;
+    uint32_t count_;
 
 public:
-    CountingSemaphore(uint32_t max_count) : _count(0),
-                                            _max_count(max_count)
+    explicit TimedMutex(bool recursive) : recursive_(recursive),
+                                          owner_(nullptr),
+                                          count_(0)
     {
     }
 
+    bool lock(TickType_t ticks)
+    {
+        InternalWaiter *self = &InternalKernel::current_waiter();
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (recursive_ && count_ && owner_ == self)
+        {
+            count_++;
+            return true;
+        }
+        bool inherited = false;
+        if (!released_.wait(lock, ticks, [this, self, ticks, &inherited]()
+                            {
+                                if (count_ == 0)
+                                {
+                                    return true;
+                                }
+                                /* Checked again after every wake-up, the holder may have changed */
+                                if (ticks && self->task && owner_->task && xTaskPriorityInherit(static_cast<TaskHandle_t>(owner_->task)))
+                                {
+                                    inherited = true;
+                                }
+                                return false; }))
+        {
+            if (inherited && count_)
+            {
+                /* This task no longer waits, the holder keeps only what the others need */
+                vTaskPriorityDisinheritAfterTimeout(static_cast<TaskHandle_t>(owner_->task), released_.top_priority());
+            }
+            return false;
+        }
+        owner_ = self;
+        count_ = 1;
+        if (self->task)
+        {
+            pvTaskIncrementMutexHeldCount();
+        }
+        return true;
+    }
+
+    /** @return false if the mutex is free or the caller does not hold it */
+    bool unlock(void)
+    {
+        InternalWaiter *self = &InternalKernel::current_waiter();
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!count_)
+        {
+            return false;
+        }
+        if (owner_ != self)
+        {
+#if configCHECK_MUTEX_GIVEN_BY_OWNER == 1
+            if (!recursive_)
+            {
+                printf("Mutex %p given by a task that does not hold it\n", (void *)this);
+                abort();
+            }
+#endif
+            return false;
+        }
+        if (--count_ == 0)
+        {
+            owner_ = nullptr;
+            if (self->task)
+            {
+                xTaskPriorityDisinherit(static_cast<TaskHandle_t>(self->task));
+            }
+            released_.notify_one();
+        }
+        return true;
+    }
+
+    bool available(void)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return count_ == 0;
+    }
+
+    /** Task holding the mutex, NULL if it is free or held outside of a task */
+    TaskHandle_t holder(void)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return count_ ? static_cast<TaskHandle_t>(owner_->task) : nullptr;
+    }
+};
+
+class QueueSet;
+
+typedef struct QueueDefinition /* The old naming convention is used to prevent breaking kernel aware debuggers. */
+{
+    union
+    {
+        TimedDeque *pQueue;
+        TimedMutex *pMutex;
+        TimedMutex *pRecursiveMutex;
+        CountingSemaphore *pSemaphore;
+        QueueSet *pSet;
+    } u;
+
+    /** Queue set the queue or semaphore is a member of, NULL if none */
+    std::atomic<QueueSet *> set{nullptr};
+    /** Link on the ready list of the set, protected by the mutex of the set */
+    struct QueueDefinition *ready_next = nullptr;
+    struct QueueDefinition *ready_prev = nullptr;
+    bool ready_linked = false;
+
+    uint8_t ucQueueType;
+
+    /** A static queue lives in its StaticQueue_t, the handle is the address of the StaticQueue_t */
+    queue_type_t type;
+} xQUEUE;
+
+/**
+ * Objects behind a static queue follow the control block in its
+ * StaticQueue_t when they fit there, otherwise they are allocated.
+ */
+template <typename T>
+struct StaticLayout
+{
+    static const size_t offset = (sizeof(xQUEUE) + alignof(T) - 1) / alignof(T) * alignof(T);
+    static const bool fits = offset + sizeof(T) <= sizeof(StaticQueue_t);
+};
+
+/**
+ * Queue set. Members that got an item (or were given) since the last select
+ * wait on an intrusive ready list like the ready list of epoll, a select only
+ * looks at them. It returns a member that is ready at the time and queues it
+ * again behind the others, so members with more items are served in turns.
+ */
+class QueueSet
+{
 public:
-    void release()
+    /** The members left in the set are released, they can be added to another set */
+    ~QueueSet()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (xQUEUE *member : members_)
+        {
+            Unlink(member);
+            member->set = nullptr;
+        }
+    }
+
+    /** Unlike FreeRTOS a member that holds items already is accepted, it is ready at once */
+    void add(xQUEUE *member)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        member->set = this;
+        members_.push_back(member);
+        Link(member);
+        ready_.notify_one();
+    }
+
+    void remove(xQUEUE *member)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        Unlink(member);
+        std::vector<xQUEUE *>::iterator found = std::find(members_.begin(), members_.end(), member);
+        if (found != members_.end())
+        {
+            members_.erase(found);
+        }
+        member->set = nullptr;
+    }
+
+    /** Called after an item was sent to the member or it was given */
+    void signal(xQUEUE *member)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!member->ready_linked)
+        {
+            Link(member);
+            ready_.notify_one();
+        }
+    }
+
+    /** @return a member that can be received from (or taken), NULL on timeout */
+    xQUEUE *select(TickType_t ticks)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        xQUEUE *member = nullptr;
+        ready_.wait(lock, ticks, [this, &member]()
+                    {
+                        member = TakeReady();
+                        return member != nullptr;
+                    });
+        return member;
+    }
+
+private:
+    std::mutex mutex_;
+    InternalCondition ready_;
+    xQUEUE *head_ = nullptr;
+    xQUEUE *tail_ = nullptr;
+    /** All the members, ready or not, a set holds a few of them */
+    std::vector<xQUEUE *> members_;
+
+    /** Drops the members that were emptied by direct receives on the way */
+    xQUEUE *TakeReady(void)
+    {
+        while (head_)
+        {
+            xQUEUE *member = head_;
+            Unlink(member);
+            if (Ready(member))
+            {
+                Link(member);
+                return member;
+            }
+        }
+        return nullptr;
+    }
+
+    /** A receive or take would not block, the member mutex is taken under the set mutex */
+    static bool Ready(xQUEUE *member)
+    {
+        switch (member->ucQueueType)
+        {
+        case queueQUEUE_TYPE_BASE:
+            return member->u.pQueue->number_of_elements() > 0;
+        case queueQUEUE_TYPE_BINARY_SEMAPHORE:
+        case queueQUEUE_TYPE_COUNTING_SEMAPHORE:
+            return member->u.pSemaphore->available() > 0;
+        case queueQUEUE_TYPE_MUTEX:
+        case queueQUEUE_TYPE_RECURSIVE_MUTEX:
+            return member->u.pMutex->available();
+        default:
+            return false;
+        }
+    }
+
+    void Link(xQUEUE *member)
     {
-        std::lock_guard<decltype(mutex_)> lock(mutex_);
-        if (_count)
+        if (member->ready_linked)
+        {
+            return;
+        }
+        member->ready_next = nullptr;
+        member->ready_prev = tail_;
+        if (tail_)
         {
-            _count--;
+            tail_->ready_next = member;
         }
         else
         {
-            //            abort();
+            head_ = member;
         }
-        condition_.notify_one();
+        tail_ = member;
+        member->ready_linked = true;
     }
 
-    void acquire()
+    void Unlink(xQUEUE *member)
     {
-        std::unique_lock<decltype(mutex_)> lock(mutex_);
-        while (_count >= _max_count)
+        if (!member->ready_linked)
+        {
+            return;
+        }
+        if (member->ready_prev)
+        {
+            member->ready_prev->ready_next = member->ready_next;
+        }
+        else
+        {
+            head_ = member->ready_next;
+        }
+        if (member->ready_next)
+        {
+            member->ready_next->ready_prev = member->ready_prev;
+        }
+        else
         {
-            condition_.wait(lock);
+            tail_ = member->ready_prev;
         }
-        _count++;
+        member->ready_next = nullptr;
+        member->ready_prev = nullptr;
+        member->ready_linked = false;
     }
+};
 
-    bool try_acquire()
+/*--------------------------------------------------------------
+                       PRIVATE FUNCTIONS
+--------------------------------------------------------------*/
+
+/** Puts a set member on the ready list of its set */
+static void prvNotifySet(QueueHandle_t xQueue)
+{
+    QueueSet *set = xQueue->set.load(std::memory_order_acquire);
+    if (set)
+    {
+        set->signal(xQueue);
+    }
+}
+
+/** Object behind the queue, in the StaticQueue_t of a static queue if it fits there */
+template <typename T, typename... Args>
+static T *prvNewObject(xQUEUE *queue, Args &&...args)
+{
+    if (queue->type == QUEUE_STATIC && StaticLayout<T>::fits)
+    {
+        return new (reinterpret_cast<uint8_t *>(queue) + StaticLayout<T>::offset) T(std::forward<Args>(args)...);
+    }
+    return new T(std::forward<Args>(args)...);
+}
+
+template <typename T>
+static void prvDeleteObject(xQUEUE *queue, T *object)
+{
+    if (queue->type == QUEUE_STATIC && StaticLayout<T>::fits)
+    {
+        object->~T();
+    }
+    else
+    {
+        delete object;
+    }
+}
+
+/**
+ * Sets *pxHigherPriorityTaskWoken if the call woke a task of a higher priority, see InternalKernel::collect_woken().
+ * A call made inside another FromISR call (a ring buffer giving its queue set semaphore) hands its tasks on to the outer one.
+ */
+static void prvReportWoken(BaseType_t *const pxHigherPriorityTaskWoken, int outer)
+{
+    if (pxHigherPriorityTaskWoken && InternalKernel::woke_higher_priority())
+    {
+        *pxHigherPriorityTaskWoken = pdTRUE;
+    }
+    InternalKernel::end_woken(outer);
+}
+
+/** Creates the queue in pxStaticQueue, or on the heap if it is NULL */
+static QueueHandle_t xQueueGenericCreateInternal(const UBaseType_t uxQueueLength,
+                                                 const UBaseType_t uxItemSize,
+                                                 const uint8_t ucQueueType,
+                                                 const UBaseType_t uxInitialCount,
+                                                 StaticQueue_t *pxStaticQueue,
+                                                 uint8_t *pucQueueStorage)
+{
+    /* Handles are used as is, the control block has to be at the start of the StaticQueue_t */
+    static_assert(sizeof(xQUEUE) <= sizeof(StaticQueue_t), "xQUEUE does not fit StaticQueue_t");
+
+    xQUEUE *queue = pxStaticQueue ? new (pxStaticQueue) xQUEUE() : new xQUEUE();
+    queue->type = pxStaticQueue ? QUEUE_STATIC : QUEUE_DYNAMIC;
+
+    switch (ucQueueType)
     {
-        std::lock_guard<decltype(mutex_)> lock(mutex_);
-        if (_count < _max_count)
+    case queueQUEUE_TYPE_BASE: // queueQUEUE_TYPE_BASE / queueQUEUE_TYPE_SET
+        if (!pxStaticQueue && uxQueueLength * uxItemSize != 0)
         {
-            _count++;
-            return true;
+            pucQueueStorage = new uint8_t[uxQueueLength * uxItemSize];
         }
-        return false;
+        queue->u.pQueue = prvNewObject<TimedDeque>(queue, uxQueueLength, uxItemSize, pucQueueStorage);
+        break;
+    case queueQUEUE_TYPE_MUTEX: // queueQUEUE_TYPE_MUTEX
+        queue->u.pMutex = prvNewObject<TimedMutex>(queue, false);
+        break;
+    case queueQUEUE_TYPE_COUNTING_SEMAPHORE: // queueQUEUE_TYPE_COUNTING_SEMAPHORE
+        queue->u.pSemaphore = prvNewObject<CountingSemaphore>(queue, uxQueueLength, uxInitialCount);
+        break;
+    case queueQUEUE_TYPE_BINARY_SEMAPHORE: // queueQUEUE_TYPE_BINARY_SEMAPHORE
+        /* Created empty, like xSemaphoreCreateBinary() */
+        queue->u.pSemaphore = prvNewObject<CountingSemaphore>(queue, 1, 0);
+        break;
+    case queueQUEUE_TYPE_RECURSIVE_MUTEX: // queueQUEUE_TYPE_RECURSIVE_MUTEX
+        queue->u.pRecursiveMutex = prvNewObject<TimedMutex>(queue, true);
+        break;
+    default:
+        printf("Unexpected queue type (xQueueGenericCreate) %d\n", ucQueueType);
+        abort();
+        return nullptr;
+    }
+
+    queue->ucQueueType = ucQueueType;
+
+    return queue;
+}
+
+/** xQueueGenericSend() without the scheduling point, the FromISR calls must not yield */
+static bool prvGenericSend(QueueHandle_t xQueue,
+                           const void *const pvItemToQueue,
+                           TickType_t xTicksToWait,
+                           const BaseType_t xCopyPosition)
+{
+    if (!xQueue)
+    {
+        abort();
     }
+    CountingSemaphore *sem = xQueue->u.pSemaphore;
+    TimedDeque *queue = xQueue->u.pQueue;
+    TimedMutex *mutex = xQueue->u.pMutex;
+    TimedMutex *rec_mutex = xQueue->u.pRecursiveMutex;
+    bool success = false;
 
-    bool try_acquire_for(uint32_t timeout_ms)
+    switch (xQueue->ucQueueType)
     {
-        std::unique_lock<decltype(mutex_)> lock(mutex_);
-        if (_count < _max_count)
+    case queueQUEUE_TYPE_BASE:
+        if (!pvItemToQueue)
         {
-            _count++;
-            return true;
+            abort();
         }
-        std::cv_status status = condition_.wait_for(lock, std::chrono::milliseconds(timeout_ms));
-        if (status == std::cv_status::no_timeout)
+        switch (xCopyPosition)
         {
-            _count++;
-            return true;
+        case queueSEND_TO_BACK:
+            success = queue->PushFront(pvItemToQueue, xTicksToWait);
+            //                    printf("PushBack to " << queue << " = " << *(uint32_t*)pvItemToQueue;
+            break;
+        case queueSEND_TO_FRONT:
+            success = queue->PushBack(pvItemToQueue, xTicksToWait);
+            //                    printf("PushFront to " << queue << " = " << *(uint32_t*)pvItemToQueue;
+            break;
+        case queueOVERWRITE:
+            success = queue->OverwriteLast(pvItemToQueue, xTicksToWait);
+            break;
+        default:
+            break;
         }
+        break;
+    case queueQUEUE_TYPE_MUTEX:
+        success = mutex->unlock();
+        break;
+    case queueQUEUE_TYPE_RECURSIVE_MUTEX:
+        success = rec_mutex->unlock();
+        break;
+    case queueQUEUE_TYPE_COUNTING_SEMAPHORE:
+    case queueQUEUE_TYPE_BINARY_SEMAPHORE:
+        success = sem->release();
+        break;
+    default:
+        printf("Unexpected queue type (xQueueGenericSend) %u\n ", (unsigned)xQueue->ucQueueType);
+        abort();
         return false;
     }
 
-    uint32_t available(void)
+    if (success)
     {
-        std::unique_lock<decltype(mutex_)> lock(mutex_);
-        return _max_count - _count;
+        prvNotifySet(xQueue);
     }
-};
+    return success;
+}
 
-typedef struct QueueDefinition /* The old naming convention is used to prevent breaking kernel aware debuggers. */
+/** xQueueReceive() without the scheduling point */
+static bool prvReceive(QueueHandle_t xQueue,
+                       void *const pvBuffer,
+                       TickType_t xTicksToWait)
 {
-    union
+    if (!xQueue)
     {
-        TimedDeque *pQueue;
-        std::timed_mutex *pMutex;
-        std::recursive_timed_mutex *pRecursiveMutex;
-        CountingSemaphore *pSemaphore;
-    } u;
-
-    UBaseType_t uxLength;   /*< The length of the queue defined as the number of items it will hold, not the number of bytes. */
-    UBaseType_t uxItemSize; /*< The size of each items that the queue will hold. */
-
-    UBaseType_t ucQueueType;
-
-    std::mutex mutex;
-
-    queue_type_t type;
-} xQUEUE;
-
-/*--------------------------------------------------------------
-                       PRIVATE FUNCTIONS
---------------------------------------------------------------*/
-
-static QueueHandle_t xQueueGenericCreateInternal(const UBaseType_t uxQueueLength,
-                                                 const UBaseType_t uxItemSize,
-                                                 const uint8_t ucQueueType,
-                                                 queue_type_t type)
-{
-    xQUEUE *queue = new xQUEUE();
+        abort();
+    }
+    TimedDeque *queue = xQueue->u.pQueue;
+    bool success = false;
 
-    switch (ucQueueType)
+    switch (xQueue->ucQueueType)
     {
-    case queueQUEUE_TYPE_BASE: // queueQUEUE_TYPE_BASE / queueQUEUE_TYPE_SET
-        queue->u.pQueue = new TimedDeque(uxQueueLength, uxItemSize);
-        break;
-    case queueQUEUE_TYPE_MUTEX: // queueQUEUE_TYPE_MUTEX
-        queue->u.pMutex = new std::timed_mutex();
-        break;
-    case queueQUEUE_TYPE_COUNTING_SEMAPHORE: // queueQUEUE_TYPE_COUNTING_SEMAPHORE
-        queue->u.pSemaphore = new CountingSemaphore(uxQueueLength);
-        break;
-    case queueQUEUE_TYPE_BINARY_SEMAPHORE: // queueQUEUE_TYPE_BINARY_SEMAPHORE
-        queue->u.pSemaphore = new CountingSemaphore(1);
+    case queueQUEUE_TYPE_BASE:
+        if (!pvBuffer)
+        {
+            abort();
+        }
+        success = queue->PopBack(pvBuffer, xTicksToWait);
         break;
-    case queueQUEUE_TYPE_RECURSIVE_MUTEX: // queueQUEUE_TYPE_RECURSIVE_MUTEX
-        queue->u.pRecursiveMutex = new std::recursive_timed_mutex();
+    case queueQUEUE_TYPE_BINARY_SEMAPHORE:
+    case queueQUEUE_TYPE_COUNTING_SEMAPHORE:
+        /* xSemaphoreTakeFromISR() */
+        success = xQueue->u.pSemaphore->acquire(xTicksToWait);
         break;
+    case queueQUEUE_TYPE_MUTEX:
+    case queueQUEUE_TYPE_RECURSIVE_MUTEX:
     default:
-        printf("Unexpected queue type (xQueueGenericCreate) %d\n", ucQueueType);
+        printf("Unexpected queue type (xQueueReceive) %u\n", (unsigned)xQueue->ucQueueType);
         abort();
-        return nullptr;
+        return false;
     }
-
-    queue->ucQueueType = ucQueueType;
-    queue->uxItemSize = uxItemSize;
-    queue->uxLength = ucQueueType;
-    queue->type = type;
-
-    return queue;
+    return success;
 }
 
 /*--------------------------------------------------------------
@@ -290,7 +1213,7 @@ QueueHandle_t xQueueGenericCreate(const UBaseType_t uxQueueLength,
                                   const UBaseType_t uxItemSize,
                                   const uint8_t ucQueueType)
 {
-    return xQueueGenericCreateInternal(uxQueueLength, uxItemSize, ucQueueType, QUEUE_DYNAMIC);
+    return xQueueGenericCreateInternal(uxQueueLength, uxItemSize, ucQueueType, 0, nullptr, nullptr);
 }
 
 QueueHandle_t xQueueGenericCreateStatic(const UBaseType_t uxQueueLength,
@@ -299,10 +1222,11 @@ QueueHandle_t xQueueGenericCreateStatic(const UBaseType_t uxQueueLength,
                                         StaticQueue_t *pxStaticQueue,
                                         const uint8_t ucQueueType)
 {
-    QueueHandle_t handle = xQueueGenericCreateInternal(uxQueueLength, uxItemSize, ucQueueType, QUEUE_STATIC);
-    memset(pxStaticQueue, 0, sizeof(StaticQueue_t));
-    pxStaticQueue->u.pvDummy2 = handle;
-    return handle;
+    if (!pxStaticQueue)
+    {
+        return NULL;
+    }
+    return xQueueGenericCreateInternal(uxQueueLength, uxItemSize, ucQueueType, 0, pxStaticQueue, pucQueueStorage);
 }
 
 QueueHandle_t xQueueCreateMutex(const uint8_t ucQueueType)
@@ -318,17 +1242,22 @@ QueueHandle_t xQueueCreateMutex(const uint8_t ucQueueType)
 QueueHandle_t xQueueCreateCountingSemaphore(const UBaseType_t uxMaxCount,
                                             const UBaseType_t uxInitialCount)
 {
-    QueueHandle_t xNewQueue;
-    const UBaseType_t uxMutexLength = (UBaseType_t)uxMaxCount, uxMutexSize = (UBaseType_t)0;
-
-    xNewQueue = xQueueGenericCreate(uxMutexLength, uxMutexSize, queueQUEUE_TYPE_COUNTING_SEMAPHORE);
-
-    for (int i = 0; i < uxMaxCount - uxInitialCount; i++)
+    if (uxMaxCount == 0 || uxInitialCount > uxMaxCount)
     {
-        xQueueTakeMutexRecursive(xNewQueue, 0);
+        return NULL;
     }
+    return xQueueGenericCreateInternal(uxMaxCount, 0, queueQUEUE_TYPE_COUNTING_SEMAPHORE, uxInitialCount, nullptr, nullptr);
+}
 
-    return xNewQueue;
+QueueHandle_t xQueueCreateCountingSemaphoreStatic(const UBaseType_t uxMaxCount,
+                                                  const UBaseType_t uxInitialCount,
+                                                  StaticQueue_t *pxStaticQueue)
+{
+    if (uxMaxCount == 0 || uxInitialCount > uxMaxCount || !pxStaticQueue)
+    {
+        return NULL;
+    }
+    return xQueueGenericCreateInternal(uxMaxCount, 0, queueQUEUE_TYPE_COUNTING_SEMAPHORE, uxInitialCount, pxStaticQueue, nullptr);
 }
 
 BaseType_t xQueueTakeMutexRecursive(QueueHandle_t xMutex,
@@ -338,60 +1267,31 @@ BaseType_t xQueueTakeMutexRecursive(QueueHandle_t xMutex,
     {
         abort();
     }
-    if (xMutex->u.pSemaphore == 0)
-    {
-        /* Static queue */
-        StaticQueue_t *xQueue_static = (StaticQueue_t *)xMutex;
-        xMutex = (QueueHandle_t)xQueue_static->u.pvDummy2;
-    }
     bool success = false;
     CountingSemaphore *sem = xMutex->u.pSemaphore;
-    std::timed_mutex *mutex = xMutex->u.pMutex;
-    std::recursive_timed_mutex *rec_mutex = xMutex->u.pRecursiveMutex;
+    TimedMutex *mutex = xMutex->u.pMutex;
+    TimedMutex *rec_mutex = xMutex->u.pRecursiveMutex;
 
     switch (xMutex->ucQueueType)
     {
     case queueQUEUE_TYPE_RECURSIVE_MUTEX:
-        if (xTicksToWait == portMAX_DELAY)
-        {
-            rec_mutex->lock();
-            success = true;
-        }
-        else
-        {
-            success = rec_mutex->try_lock_for(milliseconds(pdTICKS_TO_MS(xTicksToWait)));
-        }
+        success = rec_mutex->lock(xTicksToWait);
         break;
     case queueQUEUE_TYPE_MUTEX:
-        if (xTicksToWait == portMAX_DELAY)
-        {
-            mutex->lock();
-            success = true;
-        }
-        else
-        {
-            success = mutex->try_lock_for(milliseconds(pdTICKS_TO_MS(xTicksToWait)));
-        }
+        success = mutex->lock(xTicksToWait);
         break;
     case queueQUEUE_TYPE_BINARY_SEMAPHORE:
     case queueQUEUE_TYPE_COUNTING_SEMAPHORE:
-        if (xTicksToWait == portMAX_DELAY)
-        {
-            sem->acquire();
-            success = true;
-        }
-        else
-        {
-            success = sem->try_acquire_for(pdTICKS_TO_MS(xTicksToWait));
-        }
+        success = sem->acquire(xTicksToWait);
         break;
     case queueQUEUE_TYPE_BASE:
     default:
-        printf("Unexpected queue type (xQueueTakeMutexRecursive) %lu\n", xMutex->ucQueueType);
+        printf("Unexpected queue type (xQueueTakeMutexRecursive) %u\n", (unsigned)xMutex->ucQueueType);
         abort();
         return pdFAIL;
     }
 
+    InternalKernel::yield();
     return (success ? pdPASS : pdFAIL);
 }
 
@@ -402,59 +1302,30 @@ BaseType_t xQueueSemaphoreTake(QueueHandle_t xQueue,
     {
         abort();
     }
-    if (xQueue->u.pSemaphore == 0)
-    {
-        /* Static queue */
-        StaticQueue_t *xQueue_static = (StaticQueue_t *)xQueue;
-        xQueue = (QueueHandle_t)xQueue_static->u.pvDummy2;
-    }
     CountingSemaphore *sem = xQueue->u.pSemaphore;
-    std::timed_mutex *mutex = xQueue->u.pMutex;
-    std::recursive_timed_mutex *rec_mutex = xQueue->u.pRecursiveMutex;
+    TimedMutex *mutex = xQueue->u.pMutex;
+    TimedMutex *rec_mutex = xQueue->u.pRecursiveMutex;
     bool success = false;
 
     switch (xQueue->ucQueueType)
     {
     case queueQUEUE_TYPE_BINARY_SEMAPHORE:
     case queueQUEUE_TYPE_COUNTING_SEMAPHORE:
-        if (xTicksToWait == portMAX_DELAY)
-        {
-            sem->acquire();
-            success = true;
-        }
-        else
-        {
-            success = sem->try_acquire_for(pdTICKS_TO_MS(xTicksToWait));
-        }
+        success = sem->acquire(xTicksToWait);
         break;
     case queueQUEUE_TYPE_MUTEX:
-        if (xTicksToWait == portMAX_DELAY)
-        {
-            mutex->lock();
-            success = true;
-        }
-        else
-        {
-            success = mutex->try_lock_for(milliseconds(pdTICKS_TO_MS(xTicksToWait)));
-        }
+        success = mutex->lock(xTicksToWait);
         break;
     case queueQUEUE_TYPE_RECURSIVE_MUTEX:
-        if (xTicksToWait == portMAX_DELAY)
-        {
-            rec_mutex->lock();
-            success = true;
-        }
-        else
-        {
-            success = rec_mutex->try_lock_for(milliseconds(pdTICKS_TO_MS(xTicksToWait)));
-        }
+        success = rec_mutex->lock(xTicksToWait);
         break;
     case queueQUEUE_TYPE_BASE:
     default:
-        printf("Unexpected queue type (xQueueSemaphoreTake) %lu\n", xQueue->ucQueueType);
+        printf("Unexpected queue type (xQueueSemaphoreTake) %u\n", (unsigned)xQueue->ucQueueType);
         abort();
         return pdFAIL;
     }
+    InternalKernel::yield();
     return (success ? pdPASS : pdFAIL);
 }
 
@@ -463,66 +1334,8 @@ BaseType_t xQueueGenericSend(QueueHandle_t xQueue,
                              TickType_t xTicksToWait,
                              const BaseType_t xCopyPosition)
 {
-    if (!xQueue)
-    {
-        abort();
-    }
-    if (xQueue->u.pSemaphore == 0)
-    {
-        /* Static queue */
-        StaticQueue_t *xQueue_static = (StaticQueue_t *)xQueue;
-        xQueue = (QueueHandle_t)xQueue_static->u.pvDummy2;
-    }
-    CountingSemaphore *sem = xQueue->u.pSemaphore;
-    TimedDeque *queue = xQueue->u.pQueue;
-    std::timed_mutex *mutex = xQueue->u.pMutex;
-    std::recursive_timed_mutex *rec_mutex = xQueue->u.pRecursiveMutex;
-    bool success = false;
-    void *element = NULL;
-
-    switch (xQueue->ucQueueType)
-    {
-    case queueQUEUE_TYPE_BASE:
-        if (!pvItemToQueue)
-        {
-            abort();
-        }
-        switch (xCopyPosition)
-        {
-        case queueSEND_TO_BACK:
-            success = queue->PushFront(pvItemToQueue, pdTICKS_TO_MS(xTicksToWait));
-            //                    printf("PushBack to " << queue << " = " << *(uint32_t*)pvItemToQueue;
-            break;
-        case queueSEND_TO_FRONT:
-            success = queue->PushBack(pvItemToQueue, pdTICKS_TO_MS(xTicksToWait));
-            //                    printf("PushFront to " << queue << " = " << *(uint32_t*)pvItemToQueue;
-            break;
-        case queueOVERWRITE:
-            success = queue->OverwriteLast(pvItemToQueue, pdTICKS_TO_MS(xTicksToWait));
-            break;
-        default:
-            break;
-        }
-        break;
-    case queueQUEUE_TYPE_MUTEX:
-        mutex->unlock();
-        success = true;
-        break;
-    case queueQUEUE_TYPE_RECURSIVE_MUTEX:
-        rec_mutex->unlock();
-        success = true;
-        break;
-    case queueQUEUE_TYPE_COUNTING_SEMAPHORE:
-    case queueQUEUE_TYPE_BINARY_SEMAPHORE:
-        sem->release();
-        success = true;
-        break;
-    default:
-        printf("Unexpected queue type (xQueueGenericSend) %lu\n ", xQueue->ucQueueType);
-        abort();
-        return pdFAIL;
-    }
-
+    const bool success = prvGenericSend(xQueue, pvItemToQueue, xTicksToWait, xCopyPosition);
+    InternalKernel::yield();
     return (success ? pdPASS : pdFAIL);
 }
 
@@ -531,46 +1344,18 @@ BaseType_t xQueueGenericSendFromISR(QueueHandle_t xQueue,
                                     BaseType_t *const pxHigherPriorityTaskWoken,
                                     const BaseType_t xCopyPosition)
 {
-    return xQueueGenericSend(xQueue, pvItemToQueue, 0, xCopyPosition);
+    const int outer = InternalKernel::collect_woken();
+    const bool success = prvGenericSend(xQueue, pvItemToQueue, 0, xCopyPosition);
+    prvReportWoken(pxHigherPriorityTaskWoken, outer);
+    return (success ? pdPASS : pdFAIL);
 }
 
 BaseType_t xQueueReceive(QueueHandle_t xQueue,
                          void *const pvBuffer,
                          TickType_t xTicksToWait)
 {
-    if (!xQueue)
-    {
-        abort();
-    }
-    if (xQueue->u.pSemaphore == 0)
-    {
-        /* Static queue */
-        StaticQueue_t *xQueue_static = (StaticQueue_t *)xQueue;
-        xQueue = (QueueHandle_t)xQueue_static->u.pvDummy2;
-    }
-    TimedDeque *queue = xQueue->u.pQueue;
-    bool success = false;
-    void *element = NULL;
-
-    switch (xQueue->ucQueueType)
-    {
-    case queueQUEUE_TYPE_BASE:
-        if (!pvBuffer)
-        {
-            abort();
-        }
-        success = queue->PopBack(pvBuffer, pdTICKS_TO_MS(xTicksToWait));
-        break;
-    case queueQUEUE_TYPE_BINARY_SEMAPHORE:
-    case queueQUEUE_TYPE_COUNTING_SEMAPHORE:
-    case queueQUEUE_TYPE_MUTEX:
-    case queueQUEUE_TYPE_RECURSIVE_MUTEX:
-    default:
-        printf("Unexpected queue type (xQueueReceive) %lu\n", xQueue->ucQueueType);
-        abort();
-        return pdFAIL;
-    }
-
+    const bool success = prvReceive(xQueue, pvBuffer, xTicksToWait);
+    InternalKernel::yield();
     return (success ? pdPASS : pdFAIL);
 }
 
@@ -578,14 +1363,16 @@ BaseType_t xQueueReceiveFromISR(QueueHandle_t xQueue,
                                 void *const pvBuffer,
                                 BaseType_t *const pxHigherPriorityTaskWoken)
 {
-    *pxHigherPriorityTaskWoken = 0;
-    return xQueueReceive(xQueue, pvBuffer, 0);
+    const int outer = InternalKernel::collect_woken();
+    const bool success = prvReceive(xQueue, pvBuffer, 0);
+    prvReportWoken(pxHigherPriorityTaskWoken, outer);
+    return (success ? pdPASS : pdFAIL);
 }
 
 QueueHandle_t xQueueCreateMutexStatic(const uint8_t ucQueueType,
                                       StaticQueue_t *pxStaticQueue)
 {
-    return xQueueCreateMutex(ucQueueType);
+    return xQueueGenericCreateStatic(1, 0, nullptr, pxStaticQueue, ucQueueType);
 }
 
 BaseType_t xQueueGiveMutexRecursive(QueueHandle_t xMutex)
@@ -594,38 +1381,35 @@ BaseType_t xQueueGiveMutexRecursive(QueueHandle_t xMutex)
     {
         abort();
     }
-    if (xMutex->u.pSemaphore == 0)
-    {
-        /* Static queue */
-        StaticQueue_t *xQueue_static = (StaticQueue_t *)xMutex;
-        xMutex = (QueueHandle_t)xQueue_static->u.pvDummy2;
-    }
-    std::timed_mutex *mutex = xMutex->u.pMutex;
-    std::recursive_timed_mutex *rec_mutex = xMutex->u.pRecursiveMutex;
+    TimedMutex *mutex = xMutex->u.pMutex;
+    TimedMutex *rec_mutex = xMutex->u.pRecursiveMutex;
     CountingSemaphore *sem = xMutex->u.pSemaphore;
     bool success = false;
 
     switch (xMutex->ucQueueType)
     {
     case queueQUEUE_TYPE_MUTEX:
-        mutex->unlock();
-        success = true;
+        success = mutex->unlock();
         break;
     case queueQUEUE_TYPE_RECURSIVE_MUTEX:
-        rec_mutex->unlock();
-        success = true;
+        success = rec_mutex->unlock();
         break;
     case queueQUEUE_TYPE_BINARY_SEMAPHORE:
     case queueQUEUE_TYPE_COUNTING_SEMAPHORE:
-        sem->release();
+        success = sem->release();
         break;
     case queueQUEUE_TYPE_BASE:
     default:
-        printf("Unexpected queue type (xQueueReceive) %lu\n", xMutex->ucQueueType);
+        printf("Unexpected queue type (xQueueReceive) %u\n", (unsigned)xMutex->ucQueueType);
         abort();
         return pdFAIL;
     }
 
+    if (success)
+    {
+        prvNotifySet(xMutex);
+    }
+    InternalKernel::yield();
     return (success ? pdPASS : pdFAIL);
 }
 
@@ -636,78 +1420,87 @@ BaseType_t xQueueGiveFromISR(QueueHandle_t xQueue,
     {
         abort();
     }
-    if (xQueue->u.pSemaphore == 0)
-    {
-        /* Static queue */
-        StaticQueue_t *xQueue_static = (StaticQueue_t *)xQueue;
-        xQueue = (QueueHandle_t)xQueue_static->u.pvDummy2;
-    }
+    const int outer = InternalKernel::collect_woken();
     CountingSemaphore *sem = xQueue->u.pSemaphore;
-    std::timed_mutex *mutex = xQueue->u.pMutex;
-    std::recursive_timed_mutex *rec_mutex = xQueue->u.pRecursiveMutex;
+    TimedMutex *mutex = xQueue->u.pMutex;
+    TimedMutex *rec_mutex = xQueue->u.pRecursiveMutex;
     bool success = false;
 
     switch (xQueue->ucQueueType)
     {
     case queueQUEUE_TYPE_RECURSIVE_MUTEX:
-        rec_mutex->unlock();
-        success = true;
+        success = rec_mutex->unlock();
         break;
     case queueQUEUE_TYPE_MUTEX:
-        mutex->unlock();
-        success = true;
+        success = mutex->unlock();
         break;
     case queueQUEUE_TYPE_BINARY_SEMAPHORE:
     case queueQUEUE_TYPE_COUNTING_SEMAPHORE:
-        sem->release();
-        success = true;
+        success = sem->release();
         break;
     case queueQUEUE_TYPE_BASE:
     default:
-        printf("Unexpected queue type (xQueueGiveFromISR) %lu\n", xQueue->ucQueueType);
+        printf("Unexpected queue type (xQueueGiveFromISR) %u\n", (unsigned)xQueue->ucQueueType);
         abort();
         return pdFAIL;
     }
 
+    if (success)
+    {
+        prvNotifySet(xQueue);
+    }
+    prvReportWoken(pxHigherPriorityTaskWoken, outer);
     return (success ? pdPASS : pdFAIL);
 }
 
-UBaseType_t uxQueueMessagesWaiting(const QueueHandle_t xQueue)
+TaskHandle_t xQueueGetMutexHolder(QueueHandle_t xSemaphore)
 {
-    if (!xQueue)
+    if (!xSemaphore)
     {
         abort();
     }
-    QueueHandle_t xQueueInt;
-    if (xQueue->u.pSemaphore == 0)
+    switch (xSemaphore->ucQueueType)
     {
-        /* Static queue */
-        StaticQueue_t *xQueue_static = (StaticQueue_t *)xQueue;
-        xQueueInt = (QueueHandle_t)xQueue_static->u.pvDummy2;
+    case queueQUEUE_TYPE_MUTEX:
+        return xSemaphore->u.pMutex->holder();
+    case queueQUEUE_TYPE_RECURSIVE_MUTEX:
+        return xSemaphore->u.pRecursiveMutex->holder();
+    default:
+        return NULL;
     }
-    else
+}
+
+TaskHandle_t xQueueGetMutexHolderFromISR(QueueHandle_t xSemaphore)
+{
+    return xQueueGetMutexHolder(xSemaphore);
+}
+
+UBaseType_t uxQueueMessagesWaiting(const QueueHandle_t xQueue)
+{
+    if (!xQueue)
     {
-        xQueueInt = xQueue;
+        abort();
     }
-    TimedDeque *queue = xQueue->u.pQueue;
-    CountingSemaphore *sem = xQueueInt->u.pSemaphore;
-    std::timed_mutex *mutex = xQueueInt->u.pMutex;
-    std::recursive_timed_mutex *rec_mutex = xQueueInt->u.pRecursiveMutex;
     UBaseType_t retval = 0;
 
     switch (xQueue->ucQueueType)
     {
     case queueQUEUE_TYPE_BASE:
-        retval = queue->number_of_elements();
+        retval = xQueue->u.pQueue->number_of_elements();
         break;
     case queueQUEUE_TYPE_BINARY_SEMAPHORE:
     case queueQUEUE_TYPE_COUNTING_SEMAPHORE:
-        retval = sem->available();
+        /* uxSemaphoreGetCount(), one atomic load */
+        retval = xQueue->u.pSemaphore->available();
         break;
-    case queueQUEUE_TYPE_RECURSIVE_MUTEX:
     case queueQUEUE_TYPE_MUTEX:
+        retval = xQueue->u.pMutex->available() ? 1 : 0;
+        break;
+    case queueQUEUE_TYPE_RECURSIVE_MUTEX:
+        retval = xQueue->u.pRecursiveMutex->available() ? 1 : 0;
+        break;
     default:
-        printf("Unexpected queue type (xQueueGiveFromISR) %lu\n", xQueue->ucQueueType);
+        printf("Unexpected queue type (uxQueueMessagesWaiting) %u\n", (unsigned)xQueue->ucQueueType);
         abort();
         return pdFAIL;
     }
@@ -725,28 +1518,14 @@ BaseType_t xQueueIsQueueEmpty(const QueueHandle_t xQueue)
     {
         abort();
     }
-    QueueHandle_t xQueueInt;
-    if (xQueue->u.pSemaphore == 0)
-    {
-        /* Static queue */
-        StaticQueue_t *xQueue_static = (StaticQueue_t *)xQueue;
-        xQueueInt = (QueueHandle_t)xQueue_static->u.pvDummy2;
-    }
-    else
-    {
-        xQueueInt = xQueue;
-    }
     TimedDeque *queue = xQueue->u.pQueue;
-    CountingSemaphore *sem = xQueueInt->u.pSemaphore;
-    std::timed_mutex *mutex = xQueueInt->u.pMutex;
-    std::recursive_timed_mutex *rec_mutex = xQueueInt->u.pRecursiveMutex;
+    CountingSemaphore *sem = xQueue->u.pSemaphore;
     UBaseType_t retval = 0;
 
     switch (xQueue->ucQueueType)
     {
     case queueQUEUE_TYPE_BASE:
-        retval = queue->number_of_elements();
-        retval = !((xQueueInt->uxLength - retval) == 0);
+        retval = queue->number_of_elements() == 0;
         break;
     case queueQUEUE_TYPE_BINARY_SEMAPHORE:
     case queueQUEUE_TYPE_COUNTING_SEMAPHORE:
@@ -755,7 +1534,7 @@ BaseType_t xQueueIsQueueEmpty(const QueueHandle_t xQueue)
     case queueQUEUE_TYPE_RECURSIVE_MUTEX:
     case queueQUEUE_TYPE_MUTEX:
     default:
-        printf("Unexpected queue type (xQueueGiveFromISR) %lu\n", xQueue->ucQueueType);
+        printf("Unexpected queue type (xQueueGiveFromISR) %u\n", (unsigned)xQueue->ucQueueType);
         abort();
         return pdFAIL;
     }
@@ -773,54 +1552,117 @@ void vQueueDelete(QueueHandle_t xQueue)
     {
         abort();
     }
-    QueueHandle_t xQueueInt;
-    if (xQueue->u.pSemaphore == 0)
-    {
-        /* Static queue */
-        StaticQueue_t *xQueue_static = (StaticQueue_t *)xQueue;
-        xQueueInt = (QueueHandle_t)xQueue_static->u.pvDummy2;
-    }
-    else
+    QueueSet *set = xQueue->set.load();
+    if (set)
     {
-        xQueueInt = xQueue;
+        set->remove(xQueue);
     }
-    switch (xQueueInt->ucQueueType)
+    switch (xQueue->ucQueueType)
     {
     case queueQUEUE_TYPE_BASE: // queueQUEUE_TYPE_BASE / queueQUEUE_TYPE_SET
-        delete xQueueInt->u.pQueue;
+        if (xQueue->type == QUEUE_DYNAMIC)
+        {
+            delete[] xQueue->u.pQueue->storage();
+        }
+        prvDeleteObject(xQueue, xQueue->u.pQueue);
+        break;
+    case QUEUE_TYPE_SET:
+        delete xQueue->u.pSet;
         break;
     case queueQUEUE_TYPE_MUTEX:
-        delete xQueueInt->u.pMutex;
+        prvDeleteObject(xQueue, xQueue->u.pMutex);
         break;
     case queueQUEUE_TYPE_COUNTING_SEMAPHORE:
-        delete xQueueInt->u.pSemaphore;
+        prvDeleteObject(xQueue, xQueue->u.pSemaphore);
         break;
     case queueQUEUE_TYPE_BINARY_SEMAPHORE:
-        delete xQueueInt->u.pSemaphore;
+        prvDeleteObject(xQueue, xQueue->u.pSemaphore);
         break;
     case queueQUEUE_TYPE_RECURSIVE_MUTEX:
-        delete xQueueInt->u.pRecursiveMutex;
+        prvDeleteObject(xQueue, xQueue->u.pRecursiveMutex);
         break;
     default:
-        printf("Unexpected queue type (vQueueDelete) %ld\n", xQueueInt->ucQueueType);
+        printf("Unexpected queue type (vQueueDelete) %u\n", (unsigned)xQueue->ucQueueType);
         abort();
         return;
     }
-    delete xQueueInt;
+    if (xQueue->type == QUEUE_STATIC)
+    {
+        /* The StaticQueue_t belongs to the application */
+        xQueue->~xQUEUE();
+    }
+    else
+    {
+        delete xQueue;
+    }
+}
+
+QueueSetHandle_t xQueueCreateSet(const UBaseType_t uxEventQueueLength)
+{
+    /* The ready list holds every member at most once, it needs no length */
+    (void)uxEventQueueLength;
+    xQUEUE *queue = new xQUEUE();
+    queue->u.pSet = new QueueSet();
+    queue->ucQueueType = QUEUE_TYPE_SET;
+    queue->type = QUEUE_DYNAMIC;
+    return queue;
 }
 
 BaseType_t xQueueAddToSet(QueueSetMemberHandle_t xQueueOrSemaphore,
                           QueueSetHandle_t xQueueSet)
 {
-    printf("xQueueAddToSet not implemented\n");
-    abort();
+    if (!xQueueOrSemaphore || !xQueueSet)
+    {
+        abort();
+    }
+    if (xQueueSet->ucQueueType != QUEUE_TYPE_SET || xQueueOrSemaphore->ucQueueType == QUEUE_TYPE_SET)
+    {
+        printf("Unexpected queue type (xQueueAddToSet) %u\n", (unsigned)xQueueSet->ucQueueType);
+        abort();
+        return pdFAIL;
+    }
+    if (xQueueOrSemaphore->set.load())
+    {
+        /* Cannot add a queue/semaphore to more than one queue set */
+        return pdFAIL;
+    }
+    xQueueSet->u.pSet->add(xQueueOrSemaphore);
     return pdPASS;
 }
 
 BaseType_t xQueueRemoveFromSet(QueueSetMemberHandle_t xQueueOrSemaphore,
                                QueueSetHandle_t xQueueSet)
 {
-    printf("xQueueRemoveFromSet not implemented\n");
-    abort();
+    if (!xQueueOrSemaphore || !xQueueSet)
+    {
+        abort();
+    }
+    if (xQueueSet->ucQueueType != QUEUE_TYPE_SET || xQueueOrSemaphore->set.load() != xQueueSet->u.pSet)
+    {
+        /* The queue was not a member of the set */
+        return pdFAIL;
+    }
+    xQueueSet->u.pSet->remove(xQueueOrSemaphore);
     return pdPASS;
 }
+
+QueueSetMemberHandle_t xQueueSelectFromSet(QueueSetHandle_t xQueueSet,
+                                           const TickType_t xTicksToWait)
+{
+    if (!xQueueSet || xQueueSet->ucQueueType != QUEUE_TYPE_SET)
+    {
+        abort();
+    }
+    QueueSetMemberHandle_t member = xQueueSet->u.pSet->select(xTicksToWait);
+    InternalKernel::yield();
+    return member;
+}
+
+QueueSetMemberHandle_t xQueueSelectFromSetFromISR(QueueSetHandle_t xQueueSet)
+{
+    if (!xQueueSet || xQueueSet->ucQueueType != QUEUE_TYPE_SET)
+    {
+        abort();
+    }
+    return xQueueSet->u.pSet->select(0);
+}
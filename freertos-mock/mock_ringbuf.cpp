@@ -0,0 +1,921 @@
+/**
+ * @file mock_ringbuf.cpp
+ * @author Stanislav Karpikov
+ * @brief Mock layer for the ESP-IDF ring buffers file
+ */
+
+/*--------------------------------------------------------------
+                       INCLUDES
+--------------------------------------------------------------*/
+
+extern "C"
+{
+    #include "FreeRTOS.h"
+}
+
+/* The ring buffers are part of ESP-IDF, ringbuf.h needs its port types */
+#if ESP_PLATFORM
+
+extern "C"
+{
+    #include "semphr.h"
+    #include "ringbuf.h"
+}
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include "internal_kernel.h"
+#include "internal_mirror.h"
+
+/*--------------------------------------------------------------
+                       PRIVATE DEFINES
+--------------------------------------------------------------*/
+
+/* Items of no-split and allow-split buffers are 32-bit aligned like in ringbuf.c */
+#define RINGBUF_ALIGN_UP(size) (((size) + 3U) & ~(size_t)3U)
+#define RINGBUF_ALIGN_DOWN(size) ((size) & ~(size_t)3U)
+
+/* Item header flags */
+#define RINGBUF_ITEM_WRITTEN 0x1U /* Sent, or completed after xRingbufferSendAcquire() */
+#define RINGBUF_ITEM_SPLIT 0x2U   /* Head part of a split item, the tail part starts the next lap */
+#define RINGBUF_ITEM_DUMMY 0x4U   /* Unused end of the buffer, the next item starts at the beginning */
+#define RINGBUF_ITEM_FREE 0x8U    /* Returned, the space is reclaimed once the items before it are returned too */
+
+/*--------------------------------------------------------------
+                       PRIVATE TYPES
+--------------------------------------------------------------*/
+
+/** Precedes every item of no-split and allow-split buffers, the same 8 bytes as on the target */
+struct ItemHeader
+{
+    uint32_t length;
+    uint32_t flags;
+};
+
+#define RINGBUF_HEADER_SIZE sizeof(ItemHeader)
+
+/**
+ * ESP-IDF ring buffer in one region of size bytes, allocated once or given by
+ * the application. Items are written and read in place, senders and receivers
+ * get pointers into the region. Positions only grow, the offset in the region
+ * is the position modulo size, so full and empty need no flags: the items
+ * from free_ to read_ are handed out, read_ to write_ are readable and
+ * write_ to acquire_ are acquired but not completed yet. An item that does
+ * not fit before the end of the region leaves a dummy header there (or gets
+ * split in an allow-split buffer) and the next lap starts at offset 0.
+ * With configMOCK_MIRRORED_RINGS the region of a byte or allow-split buffer
+ * may be mapped twice, then items and byte ranges run on over the end.
+ */
+class RingBuffer
+{
+public:
+    RingBuffer(size_t size, RingbufferType_t type, uint8_t *storage)
+        : size_(size), type_(type)
+    {
+        if (!storage)
+        {
+            if (configMOCK_MIRRORED_RINGS && type_ != RINGBUF_TYPE_NOSPLIT && mirror_.map(size_))
+            {
+                /* No-split items are contiguous anyway, the target layout is kept for them */
+                storage = mirror_.base();
+                mirrored_ = true;
+            }
+            else
+            {
+                owned_.reset(new uint8_t[size_]);
+                storage = owned_.get();
+            }
+        }
+        storage_ = storage;
+        switch (type_)
+        {
+        case RINGBUF_TYPE_NOSPLIT:
+            /* Such an item fits into an empty buffer wherever the positions are */
+            maxItemSize_ = RINGBUF_ALIGN_DOWN(size_ / 2) - RINGBUF_HEADER_SIZE;
+            break;
+        case RINGBUF_TYPE_ALLOWSPLIT:
+            maxItemSize_ = size_ - 2 * RINGBUF_HEADER_SIZE;
+            break;
+        default:
+            maxItemSize_ = size_;
+            break;
+        }
+    }
+
+    ~RingBuffer()
+    {
+        QueueHandle_t semaphore = readSemaphore_.load();
+        if (semaphore)
+        {
+            vSemaphoreDelete(semaphore);
+        }
+    }
+
+    bool send(const void *item, size_t length, TickType_t ticks)
+    {
+        if (length > maxItemSize_)
+        {
+            return false;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        uint8_t *parts[2];
+        if (!spaceFreed_.wait(lock, ticks, [this, length, &parts]()
+                              { return Reserve(length, parts); }))
+        {
+            return false;
+        }
+        const uint8_t *data = static_cast<const uint8_t *>(item);
+        if (type_ == RINGBUF_TYPE_BYTEBUF)
+        {
+            /* A byte buffer takes the data in one or two pieces */
+            const size_t first = mirrored_ ? length : std::min(length, size_ - (size_t)(parts[0] - storage_));
+            Copy(parts[0], data, first);
+            Copy(storage_, data + first, length - first);
+            write_ = acquire_;
+            readable_ += length;
+            Arrived(length ? 1 : 0);
+            lock.unlock();
+            Signal();
+            return true;
+        }
+        ItemHeader *header = Header(parts[0]);
+        if (header->flags & RINGBUF_ITEM_SPLIT)
+        {
+            Copy(parts[0], data, header->length);
+            Copy(parts[1], data + header->length, Header(parts[1])->length);
+            Header(parts[1])->flags |= RINGBUF_ITEM_WRITTEN;
+        }
+        else
+        {
+            Copy(parts[0], data, length);
+        }
+        header->flags |= RINGBUF_ITEM_WRITTEN;
+        const unsigned arrived = AdvanceWrite();
+        Arrived(arrived);
+        lock.unlock();
+        if (arrived)
+        {
+            Signal();
+        }
+        return true;
+    }
+
+    /** Room for a no-split item that becomes readable after complete(), NULL on timeout */
+    void *acquire(size_t length, TickType_t ticks)
+    {
+        if (type_ != RINGBUF_TYPE_NOSPLIT || length > maxItemSize_)
+        {
+            return nullptr;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        uint8_t *parts[2];
+        if (!spaceFreed_.wait(lock, ticks, [this, length, &parts]()
+                              { return Reserve(length, parts); }))
+        {
+            return nullptr;
+        }
+        return parts[0];
+    }
+
+    /** The item and the completed items acquired after it become readable in order */
+    bool complete(void *item)
+    {
+        if (type_ != RINGBUF_TYPE_NOSPLIT)
+        {
+            return false;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        ItemHeader *header = Find(item, write_, acquire_, "xRingbufferSendComplete");
+        if (header->flags & RINGBUF_ITEM_WRITTEN)
+        {
+            Misuse("xRingbufferSendComplete", item);
+        }
+        header->flags |= RINGBUF_ITEM_WRITTEN;
+        const unsigned arrived = AdvanceWrite();
+        Arrived(arrived);
+        lock.unlock();
+        if (arrived)
+        {
+            Signal();
+        }
+        return true;
+    }
+
+    /**
+     * Hands out the next item (one part of a split item) or up to max_size bytes
+     * of a byte buffer, NULL on timeout. With tail set the tail part of a split
+     * item is handed out too.
+     */
+    void *receive(size_t *length, TickType_t ticks, size_t max_size, void **tail, size_t *tail_length)
+    {
+        void *item = nullptr;
+        size_t item_length = 0;
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!dataArrived_.wait(lock, ticks, [&]()
+                               { return Take(max_size, &item, &item_length, tail, tail_length); }))
+        {
+            return nullptr;
+        }
+        lock.unlock();
+        *length = item_length;
+        QueueHandle_t semaphore = readSemaphore_.load();
+        if (semaphore)
+        {
+            /* Taken first and given again if items are left, a send in between gives it anyway */
+            xSemaphoreTake(semaphore, 0);
+            lock.lock();
+            const bool left = Readable();
+            lock.unlock();
+            if (left)
+            {
+                xSemaphoreGiveFromISR(semaphore, nullptr);
+            }
+        }
+        return item;
+    }
+
+    /** Items may be returned in any order, the space is reclaimed in the order they were sent */
+    void give_back(void *item)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (type_ == RINGBUF_TYPE_BYTEBUF)
+        {
+            if (free_ == read_ || item != storage_ + Offset(free_))
+            {
+                Misuse("vRingbufferReturnItem", item);
+            }
+            free_ = read_;
+        }
+        else
+        {
+            ItemHeader *header = Find(item, free_, read_, "vRingbufferReturnItem");
+            if (header->flags & RINGBUF_ITEM_FREE)
+            {
+                Misuse("vRingbufferReturnItem", item);
+            }
+            header->flags |= RINGBUF_ITEM_FREE;
+            const uint64_t before = free_;
+            AdvanceFree();
+            if (free_ == before)
+            {
+                return;
+            }
+        }
+        /* Senders wait for different amounts of space */
+        spaceFreed_.notify_all();
+        if (type_ == RINGBUF_TYPE_BYTEBUF && Readable())
+        {
+            /* The next receive of a byte buffer waited for this return */
+            dataArrived_.notify_one();
+            lock.unlock();
+            Signal();
+        }
+    }
+
+    size_t max_item_size(void) const
+    {
+        return maxItemSize_;
+    }
+
+    /** Largest item a send would take now */
+    size_t free_size(void)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        const size_t space = size_ - (size_t)(acquire_ - free_);
+        if (type_ == RINGBUF_TYPE_BYTEBUF)
+        {
+            return space;
+        }
+        const size_t tail = size_ - Offset(acquire_);
+        const size_t wrap = space > tail ? space - tail : 0;
+        size_t length;
+        if (type_ == RINGBUF_TYPE_NOSPLIT)
+        {
+            const size_t room = std::max(std::min(tail, space), wrap);
+            length = room > RINGBUF_HEADER_SIZE ? room - RINGBUF_HEADER_SIZE : 0;
+        }
+        else if (!wrap || mirrored_)
+        {
+            length = space > RINGBUF_HEADER_SIZE ? space - RINGBUF_HEADER_SIZE : 0;
+        }
+        else
+        {
+            /* Split over both laps, or behind a dummy header if the end only holds a header */
+            length = (tail - RINGBUF_HEADER_SIZE) + (wrap > RINGBUF_HEADER_SIZE ? wrap - RINGBUF_HEADER_SIZE : 0);
+        }
+        return std::min(length, maxItemSize_);
+    }
+
+    /**
+     * The read semaphore is created for the first queue set, it is given while
+     * items are readable. NULL if there is none and create is false.
+     */
+    QueueHandle_t read_semaphore(bool create)
+    {
+        QueueHandle_t semaphore = readSemaphore_.load();
+        if (semaphore || !create)
+        {
+            return semaphore;
+        }
+        /* Created empty and outside the mutex */
+        QueueHandle_t created = xSemaphoreCreateBinary();
+        std::unique_lock<std::mutex> lock(mutex_);
+        semaphore = readSemaphore_.load();
+        if (!semaphore)
+        {
+            semaphore = created;
+            created = nullptr;
+            if (Readable())
+            {
+                xSemaphoreGiveFromISR(semaphore, nullptr);
+            }
+            readSemaphore_.store(semaphore);
+        }
+        lock.unlock();
+        if (created)
+        {
+            vSemaphoreDelete(created);
+        }
+        return semaphore;
+    }
+
+    bool is_read_semaphore(QueueSetMemberHandle_t member) const
+    {
+        return member && member == readSemaphore_.load();
+    }
+
+    void info(UBaseType_t *free, UBaseType_t *read, UBaseType_t *write, UBaseType_t *acquire, UBaseType_t *waiting)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (free)
+        {
+            *free = (UBaseType_t)Offset(free_);
+        }
+        if (read)
+        {
+            *read = (UBaseType_t)Offset(read_);
+        }
+        if (write)
+        {
+            *write = (UBaseType_t)Offset(write_);
+        }
+        if (acquire)
+        {
+            *acquire = (UBaseType_t)Offset(acquire_);
+        }
+        if (waiting)
+        {
+            *waiting = (UBaseType_t)readable_;
+        }
+    }
+
+    void print(void)
+    {
+        UBaseType_t free, read, write, acquire;
+        info(&free, &read, &write, &acquire, nullptr);
+        printf("Rb size:%u\tfree: %u\trptr: %u\tfreeptr: %u\twptr: %u, aptr: %u\n",
+               (unsigned)size_, (unsigned)free_size(), (unsigned)read, (unsigned)free, (unsigned)write, (unsigned)acquire);
+    }
+
+private:
+    /** Application storage of a static buffer, owned_ or mirror_ */
+    uint8_t *storage_;
+    std::unique_ptr<uint8_t[]> owned_;
+    InternalMirror mirror_;
+    bool mirrored_ = false;
+    const size_t size_;
+    const RingbufferType_t type_;
+    size_t maxItemSize_;
+    /** Positions, see the class description */
+    uint64_t free_ = 0;
+    uint64_t read_ = 0;
+    uint64_t write_ = 0;
+    uint64_t acquire_ = 0;
+    /** Items (bytes of a byte buffer) between read_ and write_ */
+    size_t readable_ = 0;
+    std::mutex mutex_;
+    InternalCondition dataArrived_;
+    InternalCondition spaceFreed_;
+    std::atomic<QueueHandle_t> readSemaphore_{nullptr};
+
+    size_t Offset(uint64_t position) const
+    {
+        return (size_t)(position % size_);
+    }
+
+    uint64_t NextLap(uint64_t position) const
+    {
+        return position - Offset(position) + size_;
+    }
+
+    /** A position with no room for a header before the end moves to the next lap */
+    uint64_t Normalize(uint64_t position) const
+    {
+        const size_t offset = Offset(position);
+        return (offset && size_ - offset < RINGBUF_HEADER_SIZE && !mirrored_) ? NextLap(position) : position;
+    }
+
+    ItemHeader *Header(uint64_t position) const
+    {
+        return reinterpret_cast<ItemHeader *>(storage_ + Offset(position));
+    }
+
+    /** Header of the item data */
+    static ItemHeader *Header(uint8_t *data)
+    {
+        return reinterpret_cast<ItemHeader *>(data - RINGBUF_HEADER_SIZE);
+    }
+
+    /** Position behind the item that starts at position */
+    uint64_t Next(uint64_t position) const
+    {
+        const ItemHeader *header = Header(position);
+        if (header->flags & RINGBUF_ITEM_DUMMY)
+        {
+            return NextLap(position);
+        }
+        return Normalize(position + RINGBUF_HEADER_SIZE + RINGBUF_ALIGN_UP(header->length));
+    }
+
+    static void Copy(uint8_t *to, const uint8_t *from, size_t length)
+    {
+        if (length)
+        {
+            std::memcpy(to, from, length);
+        }
+    }
+
+    /**
+     * Reserves room for an item at acquire_ if it fits, parts receive the data
+     * pointers (two for a split item). The headers are not marked written.
+     */
+    bool Reserve(size_t length, uint8_t **parts)
+    {
+        const size_t space = size_ - (size_t)(acquire_ - free_);
+        const size_t tail = size_ - Offset(acquire_);
+        if (type_ == RINGBUF_TYPE_BYTEBUF)
+        {
+            if (length > space)
+            {
+                return false;
+            }
+            parts[0] = storage_ + Offset(acquire_);
+            acquire_ += length;
+            return true;
+        }
+        const size_t required = RINGBUF_HEADER_SIZE + RINGBUF_ALIGN_UP(length);
+        if (required <= tail || mirrored_)
+        {
+            /* Fits before the end, skipping the end would not give more space */
+            if (required > space)
+            {
+                return false;
+            }
+            parts[0] = Place(length, 0);
+            return true;
+        }
+        if (type_ == RINGBUF_TYPE_ALLOWSPLIT && tail > RINGBUF_HEADER_SIZE)
+        {
+            /* The head part fills the end of the buffer, tail < required so the tail part is not empty */
+            const size_t head_length = tail - RINGBUF_HEADER_SIZE;
+            const size_t tail_length = length - head_length;
+            if (tail + RINGBUF_HEADER_SIZE + RINGBUF_ALIGN_UP(tail_length) > space)
+            {
+                return false;
+            }
+            parts[0] = Place(head_length, RINGBUF_ITEM_SPLIT);
+            parts[1] = Place(tail_length, 0);
+            return true;
+        }
+        if (tail + required > space)
+        {
+            return false;
+        }
+        ItemHeader *dummy = Header(acquire_);
+        dummy->length = 0;
+        dummy->flags = RINGBUF_ITEM_DUMMY | RINGBUF_ITEM_WRITTEN;
+        acquire_ = NextLap(acquire_);
+        parts[0] = Place(length, 0);
+        return true;
+    }
+
+    uint8_t *Place(size_t length, uint32_t flags)
+    {
+        ItemHeader *header = Header(acquire_);
+        header->length = (uint32_t)length;
+        header->flags = flags;
+        acquire_ = Next(acquire_);
+        return reinterpret_cast<uint8_t *>(header) + RINGBUF_HEADER_SIZE;
+    }
+
+    /** Moves write_ over the written items, @return the number of items that became readable */
+    unsigned AdvanceWrite(void)
+    {
+        unsigned arrived = 0;
+        while (write_ < acquire_)
+        {
+            const ItemHeader *header = Header(write_);
+            if (!(header->flags & RINGBUF_ITEM_WRITTEN))
+            {
+                break;
+            }
+            if (!(header->flags & (RINGBUF_ITEM_DUMMY | RINGBUF_ITEM_SPLIT)))
+            {
+                arrived++;
+            }
+            write_ = Next(write_);
+        }
+        readable_ += arrived;
+        return arrived;
+    }
+
+    /** Moves free_ over the returned items and the dummy headers */
+    void AdvanceFree(void)
+    {
+        while (free_ < read_ && (Header(free_)->flags & (RINGBUF_ITEM_FREE | RINGBUF_ITEM_DUMMY)))
+        {
+            free_ = Next(free_);
+        }
+    }
+
+    /** Skips the dummy headers in front of read_, the items behind them are readable */
+    bool Readable(void)
+    {
+        if (type_ == RINGBUF_TYPE_BYTEBUF)
+        {
+            /* Like in ringbuf.c the data handed out has to be returned first */
+            return free_ == read_ && read_ < write_;
+        }
+        const bool nothing_handed_out = free_ == read_;
+        while (read_ < write_ && (Header(read_)->flags & RINGBUF_ITEM_DUMMY))
+        {
+            read_ = NextLap(read_);
+        }
+        if (nothing_handed_out && free_ != read_)
+        {
+            free_ = read_;
+            spaceFreed_.notify_all();
+        }
+        return read_ < write_;
+    }
+
+    bool Take(size_t max_size, void **item, size_t *length, void **tail, size_t *tail_length)
+    {
+        if (max_size == 0 || !Readable())
+        {
+            return false;
+        }
+        if (type_ == RINGBUF_TYPE_BYTEBUF)
+        {
+            size_t taken = std::min((size_t)(write_ - read_), max_size);
+            if (!mirrored_)
+            {
+                /* The rest is handed out by the next call */
+                taken = std::min(taken, size_ - Offset(read_));
+            }
+            *item = storage_ + Offset(read_);
+            *length = taken;
+            read_ += taken;
+            readable_ -= taken;
+            return true;
+        }
+        const ItemHeader *header = Header(read_);
+        *item = storage_ + Offset(read_) + RINGBUF_HEADER_SIZE;
+        *length = header->length;
+        read_ = Next(read_);
+        if (header->flags & RINGBUF_ITEM_SPLIT)
+        {
+            if (!tail)
+            {
+                /* xRingbufferReceive() hands out the tail part with the next call */
+                return true;
+            }
+            const ItemHeader *tail_header = Header(read_);
+            *tail = storage_ + Offset(read_) + RINGBUF_HEADER_SIZE;
+            *tail_length = tail_header->length;
+            read_ = Next(read_);
+        }
+        readable_--;
+        return true;
+    }
+
+    /** Header of an item between the positions from and to, aborts if no item starts there */
+    ItemHeader *Find(void *item, uint64_t from, uint64_t to, const char *operation)
+    {
+        uint8_t *data = static_cast<uint8_t *>(item);
+        if (data < storage_ + RINGBUF_HEADER_SIZE || data >= storage_ + size_ + RINGBUF_HEADER_SIZE)
+        {
+            Misuse(operation, item);
+        }
+        const size_t offset = (size_t)(data - storage_) - RINGBUF_HEADER_SIZE;
+        for (uint64_t position = from; position < to; position = Next(position))
+        {
+            if (Offset(position) == offset && !(Header(position)->flags & RINGBUF_ITEM_DUMMY))
+            {
+                return Header(position);
+            }
+        }
+        Misuse(operation, item);
+        return nullptr;
+    }
+
+    /** An item that was not handed out, or was already given back, is a bug like in ringbuf.c */
+    [[noreturn]] static void Misuse(const char *operation, void *item)
+    {
+        printf("%s: %p is not an item of the ring buffer that may be passed here\n", operation, item);
+        abort();
+    }
+
+    /** Wakes receivers for the items that became readable, the mutex is held */
+    void Arrived(unsigned items)
+    {
+        if (items == 1)
+        {
+            dataArrived_.notify_one();
+        }
+        else if (items > 1)
+        {
+            dataArrived_.notify_all();
+        }
+    }
+
+    /** Gives the read semaphore of a queue set member, outside the ring buffer mutex */
+    void Signal(void)
+    {
+        QueueHandle_t semaphore = readSemaphore_.load();
+        if (semaphore)
+        {
+            xSemaphoreGiveFromISR(semaphore, nullptr);
+        }
+    }
+};
+
+/*--------------------------------------------------------------
+                       PRIVATE FUNCTIONS
+--------------------------------------------------------------*/
+
+static RingBuffer *prvRingBuffer(RingbufHandle_t xRingbuffer)
+{
+    if (!xRingbuffer)
+    {
+        abort();
+    }
+    return reinterpret_cast<RingBuffer *>(xRingbuffer);
+}
+
+/** Sets *pxHigherPriorityTaskWoken if the call woke a task of a higher priority, see InternalKernel::collect_woken() */
+static void prvReportWoken(BaseType_t *pxHigherPriorityTaskWoken)
+{
+    if (pxHigherPriorityTaskWoken && InternalKernel::woke_higher_priority())
+    {
+        *pxHigherPriorityTaskWoken = pdTRUE;
+    }
+}
+
+static RingbufHandle_t prvCreate(size_t xBufferSize, RingbufferType_t xBufferType, uint8_t *pucStorage)
+{
+    if (xBufferType >= RINGBUF_TYPE_MAX)
+    {
+        return nullptr;
+    }
+    if (xBufferType != RINGBUF_TYPE_BYTEBUF)
+    {
+        if (pucStorage && xBufferSize != RINGBUF_ALIGN_UP(xBufferSize))
+        {
+            return nullptr;
+        }
+        xBufferSize = RINGBUF_ALIGN_UP(xBufferSize);
+        if (xBufferSize <= 2 * RINGBUF_HEADER_SIZE || xBufferSize > UINT32_MAX)
+        {
+            return nullptr;
+        }
+    }
+    else if (xBufferSize == 0)
+    {
+        return nullptr;
+    }
+    return reinterpret_cast<RingbufHandle_t>(new RingBuffer(xBufferSize, xBufferType, pucStorage));
+}
+
+static void *prvReceive(RingbufHandle_t xRingbuffer, size_t *pxItemSize, TickType_t xTicksToWait, size_t xMaxSize)
+{
+    size_t size;
+    void *item = prvRingBuffer(xRingbuffer)->receive(&size, xTicksToWait, xMaxSize, nullptr, nullptr);
+    if (item && pxItemSize)
+    {
+        *pxItemSize = size;
+    }
+    return item;
+}
+
+static BaseType_t prvReceiveSplit(RingbufHandle_t xRingbuffer,
+                                  void **ppvHeadItem,
+                                  void **ppvTailItem,
+                                  size_t *pxHeadItemSize,
+                                  size_t *pxTailItemSize,
+                                  TickType_t xTicksToWait)
+{
+    if (!ppvHeadItem || !ppvTailItem)
+    {
+        return pdFALSE;
+    }
+    void *tail = nullptr;
+    size_t head_size = 0, tail_size = 0;
+    *ppvHeadItem = prvRingBuffer(xRingbuffer)->receive(&head_size, xTicksToWait, SIZE_MAX, &tail, &tail_size);
+    *ppvTailItem = tail;
+    if (!*ppvHeadItem)
+    {
+        return pdFALSE;
+    }
+    if (pxHeadItemSize)
+    {
+        *pxHeadItemSize = head_size;
+    }
+    if (tail && pxTailItemSize)
+    {
+        *pxTailItemSize = tail_size;
+    }
+    return pdTRUE;
+}
+
+/*--------------------------------------------------------------
+                      PUBLIC FUNCTIONS
+--------------------------------------------------------------*/
+
+RingbufHandle_t xRingbufferCreate(size_t xBufferSize, RingbufferType_t xBufferType)
+{
+    return prvCreate(xBufferSize, xBufferType, nullptr);
+}
+
+RingbufHandle_t xRingbufferCreateNoSplit(size_t xItemSize, size_t xItemNum)
+{
+    return prvCreate((RINGBUF_ALIGN_UP(xItemSize) + RINGBUF_HEADER_SIZE) * xItemNum, RINGBUF_TYPE_NOSPLIT, nullptr);
+}
+
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+RingbufHandle_t xRingbufferCreateStatic(size_t xBufferSize,
+                                        RingbufferType_t xBufferType,
+                                        uint8_t *pucRingbufferStorage,
+                                        StaticRingbuffer_t *pxStaticRingbuffer)
+{
+    if (!pucRingbufferStorage || !pxStaticRingbuffer)
+    {
+        return nullptr;
+    }
+    RingbufHandle_t handle = prvCreate(xBufferSize, xBufferType, pucRingbufferStorage);
+    memset(pxStaticRingbuffer, 0, sizeof(StaticRingbuffer_t));
+    pxStaticRingbuffer->pvDummy4[0] = handle;
+    return handle;
+}
+#endif
+
+BaseType_t xRingbufferSend(RingbufHandle_t xRingbuffer,
+                           const void *pvItem,
+                           size_t xItemSize,
+                           TickType_t xTicksToWait)
+{
+    const bool sent = prvRingBuffer(xRingbuffer)->send(pvItem, xItemSize, xTicksToWait);
+    InternalKernel::yield();
+    return sent ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xRingbufferSendFromISR(RingbufHandle_t xRingbuffer,
+                                  const void *pvItem,
+                                  size_t xItemSize,
+                                  BaseType_t *pxHigherPriorityTaskWoken)
+{
+    InternalKernel::collect_woken();
+    const bool sent = prvRingBuffer(xRingbuffer)->send(pvItem, xItemSize, 0);
+    prvReportWoken(pxHigherPriorityTaskWoken);
+    return sent ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xRingbufferSendAcquire(RingbufHandle_t xRingbuffer, void **ppvItem, size_t xItemSize, TickType_t xTicksToWait)
+{
+    if (!ppvItem)
+    {
+        return pdFALSE;
+    }
+    *ppvItem = prvRingBuffer(xRingbuffer)->acquire(xItemSize, xTicksToWait);
+    return *ppvItem ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xRingbufferSendComplete(RingbufHandle_t xRingbuffer, void *pvItem)
+{
+    const bool completed = prvRingBuffer(xRingbuffer)->complete(pvItem);
+    InternalKernel::yield();
+    return completed ? pdTRUE : pdFALSE;
+}
+
+void *xRingbufferReceive(RingbufHandle_t xRingbuffer, size_t *pxItemSize, TickType_t xTicksToWait)
+{
+    void *item = prvReceive(xRingbuffer, pxItemSize, xTicksToWait, SIZE_MAX);
+    InternalKernel::yield();
+    return item;
+}
+
+void *xRingbufferReceiveFromISR(RingbufHandle_t xRingbuffer, size_t *pxItemSize)
+{
+    return prvReceive(xRingbuffer, pxItemSize, 0, SIZE_MAX);
+}
+
+BaseType_t xRingbufferReceiveSplit(RingbufHandle_t xRingbuffer,
+                                   void **ppvHeadItem,
+                                   void **ppvTailItem,
+                                   size_t *pxHeadItemSize,
+                                   size_t *pxTailItemSize,
+                                   TickType_t xTicksToWait)
+{
+    const BaseType_t received = prvReceiveSplit(xRingbuffer, ppvHeadItem, ppvTailItem, pxHeadItemSize, pxTailItemSize, xTicksToWait);
+    InternalKernel::yield();
+    return received;
+}
+
+BaseType_t xRingbufferReceiveSplitFromISR(RingbufHandle_t xRingbuffer,
+                                          void **ppvHeadItem,
+                                          void **ppvTailItem,
+                                          size_t *pxHeadItemSize,
+                                          size_t *pxTailItemSize)
+{
+    return prvReceiveSplit(xRingbuffer, ppvHeadItem, ppvTailItem, pxHeadItemSize, pxTailItemSize, 0);
+}
+
+void *xRingbufferReceiveUpTo(RingbufHandle_t xRingbuffer,
+                             size_t *pxItemSize,
+                             TickType_t xTicksToWait,
+                             size_t xMaxSize)
+{
+    void *item = prvReceive(xRingbuffer, pxItemSize, xTicksToWait, xMaxSize);
+    InternalKernel::yield();
+    return item;
+}
+
+void *xRingbufferReceiveUpToFromISR(RingbufHandle_t xRingbuffer, size_t *pxItemSize, size_t xMaxSize)
+{
+    return prvReceive(xRingbuffer, pxItemSize, 0, xMaxSize);
+}
+
+void vRingbufferReturnItem(RingbufHandle_t xRingbuffer, void *pvItem)
+{
+    prvRingBuffer(xRingbuffer)->give_back(pvItem);
+    InternalKernel::yield();
+}
+
+void vRingbufferReturnItemFromISR(RingbufHandle_t xRingbuffer, void *pvItem, BaseType_t *pxHigherPriorityTaskWoken)
+{
+    InternalKernel::collect_woken();
+    prvRingBuffer(xRingbuffer)->give_back(pvItem);
+    prvReportWoken(pxHigherPriorityTaskWoken);
+}
+
+void vRingbufferDelete(RingbufHandle_t xRingbuffer)
+{
+    delete prvRingBuffer(xRingbuffer);
+}
+
+size_t xRingbufferGetMaxItemSize(RingbufHandle_t xRingbuffer)
+{
+    return prvRingBuffer(xRingbuffer)->max_item_size();
+}
+
+size_t xRingbufferGetCurFreeSize(RingbufHandle_t xRingbuffer)
+{
+    return prvRingBuffer(xRingbuffer)->free_size();
+}
+
+BaseType_t xRingbufferAddToQueueSetRead(RingbufHandle_t xRingbuffer, QueueSetHandle_t xQueueSet)
+{
+    return xQueueAddToSet(prvRingBuffer(xRingbuffer)->read_semaphore(true), xQueueSet);
+}
+
+BaseType_t xRingbufferCanRead(RingbufHandle_t xRingbuffer, QueueSetMemberHandle_t xMember)
+{
+    return prvRingBuffer(xRingbuffer)->is_read_semaphore(xMember) ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xRingbufferRemoveFromQueueSetRead(RingbufHandle_t xRingbuffer, QueueSetHandle_t xQueueSet)
+{
+    QueueHandle_t semaphore = prvRingBuffer(xRingbuffer)->read_semaphore(false);
+    return semaphore ? xQueueRemoveFromSet(semaphore, xQueueSet) : pdFALSE;
+}
+
+void vRingbufferGetInfo(RingbufHandle_t xRingbuffer,
+                        UBaseType_t *uxFree,
+                        UBaseType_t *uxRead,
+                        UBaseType_t *uxWrite,
+                        UBaseType_t *uxAcquire,
+                        UBaseType_t *uxItemsWaiting)
+{
+    prvRingBuffer(xRingbuffer)->info(uxFree, uxRead, uxWrite, uxAcquire, uxItemsWaiting);
+}
+
+void xRingbufferPrintInfo(RingbufHandle_t xRingbuffer)
+{
+    prvRingBuffer(xRingbuffer)->print();
+}
+
+#endif /* ESP_PLATFORM */
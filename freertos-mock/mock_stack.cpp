@@ -0,0 +1,175 @@
+/**
+ * @file mock_stack.cpp
+ * @author Stanislav Karpikov
+ * @brief Mock layer for FreeRTOS, task stacks with guard pages and fill patterns
+ */
+
+/*--------------------------------------------------------------
+                       INCLUDES
+--------------------------------------------------------------*/
+
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "internal_stack.h"
+#include "internal_thread_pool.h"
+
+/*--------------------------------------------------------------
+                       PRIVATE DEFINES
+--------------------------------------------------------------*/
+
+/* Same value as tskSTACK_FILL_BYTE in tasks.c */
+#define STACK_FILL_BYTE 0xa5U
+
+/* Bytes at the stack base checked by the overflow check, tasks.c checks 16 too */
+#define STACK_CHECK_BYTES 16
+
+/*--------------------------------------------------------------
+                       PRIVATE DATA
+--------------------------------------------------------------*/
+
+/** Mappings of deleted tasks (mapping and its size), kept like the threads of the thread pool */
+static std::mutex stack_pool_mutex;
+static std::vector<std::pair<void *, size_t>> free_stacks;
+
+#if MOCK_STACK_PAINTING
+/** Painted memory to compare the stacks against */
+static const struct FillBlock
+{
+    unsigned char bytes[1024];
+    FillBlock()
+    {
+        memset(bytes, STACK_FILL_BYTE, sizeof(bytes));
+    }
+} fill_block;
+#endif
+
+/*--------------------------------------------------------------
+                       PRIVATE FUNCTIONS
+--------------------------------------------------------------*/
+
+/** A mapping of the same size with its guard page already set up, NULL if there is none */
+static void *prvReuseMapping(size_t mapping_size)
+{
+    std::unique_lock<std::mutex> lock(stack_pool_mutex);
+    for (auto it = free_stacks.begin(); it != free_stacks.end(); ++it)
+    {
+        if (it->second == mapping_size)
+        {
+            void *mapping = it->first;
+            free_stacks.erase(it);
+            return mapping;
+        }
+    }
+    return nullptr;
+}
+
+/*--------------------------------------------------------------
+                      PUBLIC FUNCTIONS
+--------------------------------------------------------------*/
+
+InternalStack::~InternalStack()
+{
+    if (!mapping_)
+    {
+        return;
+    }
+#if configMOCK_TASK_POOL_SIZE > 0
+    {
+        std::unique_lock<std::mutex> lock(stack_pool_mutex);
+        if (free_stacks.size() < configMOCK_TASK_POOL_SIZE)
+        {
+            free_stacks.emplace_back(mapping_, mapping_size_);
+            return;
+        }
+    }
+#endif
+    munmap(mapping_, mapping_size_);
+}
+
+bool InternalStack::allocate(size_t size)
+{
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size = (size + page - 1) / page * page;
+
+    void *mapping = prvReuseMapping(size + page);
+    if (!mapping)
+    {
+        /* Stacks grow down, the lowest page stays inaccessible to catch overflows */
+        mapping = mmap(nullptr, size + page, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+        if (mapping == MAP_FAILED)
+        {
+            return false;
+        }
+        mprotect(mapping, page, PROT_NONE);
+    }
+    mapping_ = mapping;
+    mapping_size_ = size + page;
+    base_ = static_cast<char *>(mapping) + page;
+    size_ = size;
+    repaint(base_ + size_);
+    return true;
+}
+
+void InternalStack::borrow(void *buffer, size_t size)
+{
+    base_ = static_cast<char *>(buffer);
+    size_ = size;
+    repaint(base_ + size_);
+}
+
+void InternalStack::repaint(const char *limit)
+{
+#if MOCK_STACK_PAINTING
+    const char *dirty = deepest();
+    if (dirty < limit)
+    {
+        memset(const_cast<char *>(dirty), STACK_FILL_BYTE, limit - dirty);
+    }
+#else
+    (void)limit;
+#endif
+}
+
+const char *InternalStack::deepest(void) const
+{
+#if MOCK_STACK_PAINTING
+    const char *top = base_ + size_;
+    const char *it = base_;
+    /* Block by block through the untouched part with memcmp(), it is most of the stack */
+    while (it + sizeof(fill_block.bytes) <= top && memcmp(it, fill_block.bytes, sizeof(fill_block.bytes)) == 0)
+    {
+        it += sizeof(fill_block.bytes);
+    }
+    while (it < top && (unsigned char)*it == STACK_FILL_BYTE)
+    {
+        it++;
+    }
+    return it;
+#else
+    return base_;
+#endif
+}
+
+bool InternalStack::overflowed(const char *sp) const
+{
+    if (sp < base_ + STACK_CHECK_BYTES)
+    {
+        return true;
+    }
+#if configCHECK_FOR_STACK_OVERFLOW > 1 && MOCK_STACK_PAINTING
+    for (int i = 0; i < STACK_CHECK_BYTES; i++)
+    {
+        if ((unsigned char)base_[i] != STACK_FILL_BYTE)
+        {
+            return true;
+        }
+    }
+#endif
+    return false;
+}
@@ -0,0 +1,443 @@
+/**
+ * @file mock_stream_buffer.cpp
+ * @author Stanislav Karpikov
+ * @brief Mock layer for FreeRTOS stream and message buffers file
+ */
+
+/*--------------------------------------------------------------
+                       INCLUDES
+--------------------------------------------------------------*/
+
+extern "C"
+{
+    #include "FreeRTOS.h"
+    #include "stream_buffer.h"
+}
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include "internal_kernel.h"
+#include "internal_mirror.h"
+
+/*--------------------------------------------------------------
+                       PRIVATE DEFINES
+--------------------------------------------------------------*/
+
+#ifndef configMESSAGE_BUFFER_LENGTH_TYPE
+#define configMESSAGE_BUFFER_LENGTH_TYPE size_t
+#endif
+
+/* Every message of a message buffer is stored behind its length */
+#define MESSAGE_HEADER_SIZE sizeof(configMESSAGE_BUFFER_LENGTH_TYPE)
+
+/*--------------------------------------------------------------
+                       PRIVATE TYPES
+--------------------------------------------------------------*/
+
+/**
+ * Stream or message buffer: bytes are copied in place into one ring of
+ * size bytes, allocated once or given by the application. A receiver blocks
+ * on an empty buffer until the trigger level is reached (a whole message for
+ * message buffers), a sender until its data fits.
+ */
+class StreamBuffer
+{
+public:
+    StreamBuffer(size_t size, size_t trigger, bool message, uint8_t *storage)
+        : size_(size), trigger_(trigger ? trigger : 1), message_(message)
+    {
+        if (!storage)
+        {
+            if (configMOCK_MIRRORED_RINGS && mirror_.map(size_))
+            {
+                storage = mirror_.base();
+                mirrored_ = true;
+            }
+            else
+            {
+                owned_.reset(new uint8_t[size_]);
+                storage = owned_.get();
+            }
+        }
+        storage_ = storage;
+    }
+
+    size_t send(const void *data, size_t length, TickType_t ticks)
+    {
+        size_t required = length + (message_ ? MESSAGE_HEADER_SIZE : 0);
+        if (message_ && required > size_)
+        {
+            /* The message would never fit */
+            return 0;
+        }
+        if (!message_)
+        {
+            /* Longer data waits for an empty buffer and sends what fits, as in stream_buffer.c */
+            required = std::min(required, size_);
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (size_ - count_ < required && ticks)
+        {
+            sendersBlocked_++;
+            spaceFreed_.wait(lock, ticks, [this, required]()
+                             { return size_ - count_ >= required; });
+            sendersBlocked_--;
+        }
+        const size_t space = size_ - count_;
+        size_t written;
+        if (message_)
+        {
+            if (space < required)
+            {
+                return 0;
+            }
+            const configMESSAGE_BUFFER_LENGTH_TYPE header = (configMESSAGE_BUFFER_LENGTH_TYPE)length;
+            Write(&header, MESSAGE_HEADER_SIZE);
+            Write(data, length);
+            written = length;
+        }
+        else
+        {
+            written = std::min(length, space);
+            Write(data, written);
+        }
+        if (written && count_ >= trigger_)
+        {
+            dataArrived_.notify_one();
+        }
+        return written;
+    }
+
+    size_t receive(void *data, size_t length, TickType_t ticks)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (count_ == 0 && ticks)
+        {
+            /* Like in stream_buffer.c the first notification ends the wait, the trigger level decides when it comes */
+            const uint32_t completions = completions_;
+            receiversBlocked_++;
+            dataArrived_.wait(lock, ticks, [this, completions]()
+                              { return count_ >= trigger_ || completions_ != completions; });
+            receiversBlocked_--;
+        }
+        size_t read;
+        if (message_)
+        {
+            const size_t next = NextMessageLength();
+            if (count_ == 0 || next > length)
+            {
+                /* The message stays in the buffer if it does not fit */
+                return 0;
+            }
+            Read(nullptr, MESSAGE_HEADER_SIZE);
+            Read(data, next);
+            read = next;
+        }
+        else
+        {
+            read = std::min(length, count_);
+            Read(data, read);
+        }
+        if (read)
+        {
+            /* Senders wait for different amounts of space */
+            spaceFreed_.notify_all();
+        }
+        return read;
+    }
+
+    /** Length of the next message, 0 for an empty buffer or a stream buffer */
+    size_t next_message_length(void)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return (message_ && count_) ? NextMessageLength() : 0;
+    }
+
+    size_t bytes_available(void)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return count_;
+    }
+
+    size_t spaces_available(void)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return size_ - count_;
+    }
+
+    bool set_trigger_level(size_t trigger)
+    {
+        if (trigger > size_)
+        {
+            return false;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        trigger_ = trigger ? trigger : 1;
+        return true;
+    }
+
+    /** Fails while a task is blocked on the buffer, like in stream_buffer.c */
+    bool reset(void)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (sendersBlocked_ || receiversBlocked_)
+        {
+            return false;
+        }
+        head_ = 0;
+        count_ = 0;
+        return true;
+    }
+
+    /** Ends the wait of a blocked receiver below the trigger level */
+    bool send_completed(void)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        completions_++;
+        const bool waiting = receiversBlocked_ != 0;
+        dataArrived_.notify_all();
+        return waiting;
+    }
+
+    /** Ends the wait of a blocked sender */
+    bool receive_completed(void)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        const bool waiting = sendersBlocked_ != 0;
+        spaceFreed_.notify_all();
+        return waiting;
+    }
+
+private:
+    /** Application storage of a static buffer, owned_ or mirror_ */
+    uint8_t *storage_;
+    std::unique_ptr<uint8_t[]> owned_;
+    InternalMirror mirror_;
+    /** Data that wraps around is contiguous, one memcpy() moves it */
+    bool mirrored_ = false;
+    const size_t size_;
+    size_t trigger_;
+    const bool message_;
+    /** Offset of the oldest byte and the number of bytes stored */
+    size_t head_ = 0;
+    size_t count_ = 0;
+    std::mutex mutex_;
+    InternalCondition dataArrived_;
+    InternalCondition spaceFreed_;
+    unsigned sendersBlocked_ = 0;
+    unsigned receiversBlocked_ = 0;
+    /** Counts xStreamBufferSendCompletedFromISR() calls */
+    uint32_t completions_ = 0;
+
+    /** Appends length bytes, the caller checked the space */
+    void Write(const void *data, size_t length)
+    {
+        size_t tail = head_ + count_;
+        if (tail >= size_)
+        {
+            tail -= size_;
+        }
+        const size_t first = mirrored_ ? length : std::min(length, size_ - tail);
+        std::memcpy(storage_ + tail, data, first);
+        std::memcpy(storage_, static_cast<const uint8_t *>(data) + first, length - first);
+        count_ += length;
+    }
+
+    /** Copies length bytes from the head (or only drops them if data is NULL) */
+    void Read(void *data, size_t length)
+    {
+        Peek(data, length);
+        head_ += length;
+        if (head_ >= size_)
+        {
+            head_ -= size_;
+        }
+        count_ -= length;
+    }
+
+    void Peek(void *data, size_t length) const
+    {
+        if (!data)
+        {
+            return;
+        }
+        const size_t first = mirrored_ ? length : std::min(length, size_ - head_);
+        std::memcpy(data, storage_ + head_, first);
+        std::memcpy(static_cast<uint8_t *>(data) + first, storage_, length - first);
+    }
+
+    size_t NextMessageLength(void) const
+    {
+        configMESSAGE_BUFFER_LENGTH_TYPE header = 0;
+        if (count_ >= MESSAGE_HEADER_SIZE)
+        {
+            Peek(&header, MESSAGE_HEADER_SIZE);
+        }
+        return header;
+    }
+};
+
+/*--------------------------------------------------------------
+                       PRIVATE FUNCTIONS
+--------------------------------------------------------------*/
+
+static StreamBuffer *prvStreamBuffer(StreamBufferHandle_t xStreamBuffer)
+{
+    if (!xStreamBuffer)
+    {
+        abort();
+    }
+    return reinterpret_cast<StreamBuffer *>(xStreamBuffer);
+}
+
+/** Sets *pxHigherPriorityTaskWoken if the call woke a task of a higher priority, see InternalKernel::collect_woken() */
+static void prvReportWoken(BaseType_t *const pxHigherPriorityTaskWoken)
+{
+    if (pxHigherPriorityTaskWoken && InternalKernel::woke_higher_priority())
+    {
+        *pxHigherPriorityTaskWoken = pdTRUE;
+    }
+}
+
+static StreamBufferHandle_t prvCreate(size_t xBufferSizeBytes,
+                                      size_t xTriggerLevelBytes,
+                                      BaseType_t xIsMessageBuffer,
+                                      uint8_t *pucStorage)
+{
+    if (xBufferSizeBytes == 0 || xTriggerLevelBytes > xBufferSizeBytes)
+    {
+        return nullptr;
+    }
+    if (xIsMessageBuffer && xBufferSizeBytes <= MESSAGE_HEADER_SIZE)
+    {
+        return nullptr;
+    }
+    StreamBuffer *buffer = new StreamBuffer(xBufferSizeBytes, xTriggerLevelBytes, xIsMessageBuffer != pdFALSE, pucStorage);
+    return reinterpret_cast<StreamBufferHandle_t>(buffer);
+}
+
+/*--------------------------------------------------------------
+                       PUBLIC FUNCTIONS
+--------------------------------------------------------------*/
+
+StreamBufferHandle_t xStreamBufferGenericCreate(size_t xBufferSizeBytes,
+                                                size_t xTriggerLevelBytes,
+                                                BaseType_t xIsMessageBuffer)
+{
+    return prvCreate(xBufferSizeBytes, xTriggerLevelBytes, xIsMessageBuffer, nullptr);
+}
+
+StreamBufferHandle_t xStreamBufferGenericCreateStatic(size_t xBufferSizeBytes,
+                                                      size_t xTriggerLevelBytes,
+                                                      BaseType_t xIsMessageBuffer,
+                                                      uint8_t *const pucStreamBufferStorageArea,
+                                                      StaticStreamBuffer_t *const pxStaticStreamBuffer)
+{
+    if (!pucStreamBufferStorageArea || !pxStaticStreamBuffer)
+    {
+        return nullptr;
+    }
+    StreamBufferHandle_t handle = prvCreate(xBufferSizeBytes, xTriggerLevelBytes, xIsMessageBuffer, pucStreamBufferStorageArea);
+    memset(pxStaticStreamBuffer, 0, sizeof(StaticStreamBuffer_t));
+    pxStaticStreamBuffer->pvDummy2[0] = handle;
+    return handle;
+}
+
+void vStreamBufferDelete(StreamBufferHandle_t xStreamBuffer)
+{
+    delete prvStreamBuffer(xStreamBuffer);
+}
+
+size_t xStreamBufferSend(StreamBufferHandle_t xStreamBuffer,
+                         const void *pvTxData,
+                         size_t xDataLengthBytes,
+                         TickType_t xTicksToWait)
+{
+    const size_t sent = prvStreamBuffer(xStreamBuffer)->send(pvTxData, xDataLengthBytes, xTicksToWait);
+    InternalKernel::yield();
+    return sent;
+}
+
+size_t xStreamBufferSendFromISR(StreamBufferHandle_t xStreamBuffer,
+                                const void *pvTxData,
+                                size_t xDataLengthBytes,
+                                BaseType_t *const pxHigherPriorityTaskWoken)
+{
+    InternalKernel::collect_woken();
+    const size_t sent = prvStreamBuffer(xStreamBuffer)->send(pvTxData, xDataLengthBytes, 0);
+    prvReportWoken(pxHigherPriorityTaskWoken);
+    return sent;
+}
+
+size_t xStreamBufferReceive(StreamBufferHandle_t xStreamBuffer,
+                            void *pvRxData,
+                            size_t xBufferLengthBytes,
+                            TickType_t xTicksToWait)
+{
+    const size_t received = prvStreamBuffer(xStreamBuffer)->receive(pvRxData, xBufferLengthBytes, xTicksToWait);
+    InternalKernel::yield();
+    return received;
+}
+
+size_t xStreamBufferReceiveFromISR(StreamBufferHandle_t xStreamBuffer,
+                                   void *pvRxData,
+                                   size_t xBufferLengthBytes,
+                                   BaseType_t *const pxHigherPriorityTaskWoken)
+{
+    InternalKernel::collect_woken();
+    const size_t received = prvStreamBuffer(xStreamBuffer)->receive(pvRxData, xBufferLengthBytes, 0);
+    prvReportWoken(pxHigherPriorityTaskWoken);
+    return received;
+}
+
+size_t xStreamBufferNextMessageLengthBytes(StreamBufferHandle_t xStreamBuffer)
+{
+    return prvStreamBuffer(xStreamBuffer)->next_message_length();
+}
+
+BaseType_t xStreamBufferIsFull(StreamBufferHandle_t xStreamBuffer)
+{
+    return prvStreamBuffer(xStreamBuffer)->spaces_available() == 0 ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xStreamBufferIsEmpty(StreamBufferHandle_t xStreamBuffer)
+{
+    return prvStreamBuffer(xStreamBuffer)->bytes_available() == 0 ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xStreamBufferReset(StreamBufferHandle_t xStreamBuffer)
+{
+    return prvStreamBuffer(xStreamBuffer)->reset() ? pdPASS : pdFAIL;
+}
+
+size_t xStreamBufferSpacesAvailable(StreamBufferHandle_t xStreamBuffer)
+{
+    return prvStreamBuffer(xStreamBuffer)->spaces_available();
+}
+
+size_t xStreamBufferBytesAvailable(StreamBufferHandle_t xStreamBuffer)
+{
+    return prvStreamBuffer(xStreamBuffer)->bytes_available();
+}
+
+BaseType_t xStreamBufferSetTriggerLevel(StreamBufferHandle_t xStreamBuffer, size_t xTriggerLevel)
+{
+    return prvStreamBuffer(xStreamBuffer)->set_trigger_level(xTriggerLevel) ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xStreamBufferSendCompletedFromISR(StreamBufferHandle_t xStreamBuffer, BaseType_t *pxHigherPriorityTaskWoken)
+{
+    InternalKernel::collect_woken();
+    const bool woken = prvStreamBuffer(xStreamBuffer)->send_completed();
+    prvReportWoken(pxHigherPriorityTaskWoken);
+    return woken ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xStreamBufferReceiveCompletedFromISR(StreamBufferHandle_t xStreamBuffer, BaseType_t *pxHigherPriorityTaskWoken)
+{
+    InternalKernel::collect_woken();
+    const bool woken = prvStreamBuffer(xStreamBuffer)->receive_completed();
+    prvReportWoken(pxHigherPriorityTaskWoken);
+    return woken ? pdTRUE : pdFALSE;
+}
@@ -11,13 +11,16 @@
 #include <algorithm>
 #include <atomic>
 #include <condition_variable>
+#include <cstdio>
 #include <cstdlib>
-#include <iostream>
-#include <thread>
+#include <cstring>
+#include <iterator>
 #include <chrono>
 #include <string>
-#include <list>
-#include <unistd.h>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 extern "C"
 {
     #include "FreeRTOS.h"
@@ -25,137 +28,969 @@ extern "C"
     #include "portmacro.h"
 }
 #include <signal.h>
+#include "internal_host.h"
+#include "internal_kernel.h"
+#include "internal_thread_pool.h"
 
 /*--------------------------------------------------------------
                        PRIVATE DEFINES
 --------------------------------------------------------------*/
 
-/** Maximum waiting time to get the task into suspended state */
-#define WAIT_FOR_TASK_SUSPENDED_TIMEOUT 3000
+#ifndef configIDLE_TASK_NAME
+#define configIDLE_TASK_NAME "IDLE"
+#endif
+
+/* Same value as in the ESP-IDF task.h, any core id outside the cores leaves a task unpinned */
+#ifndef tskNO_AFFINITY
+#define tskNO_AFFINITY ((BaseType_t)0x7FFFFFFF)
+#endif
+
+#ifndef configTASK_NOTIFICATION_ARRAY_ENTRIES
+#define configTASK_NOTIFICATION_ARRAY_ENTRIES 1
+#endif
+
+/* Notification states, the same values as in tasks.c */
+#define NOTIFY_NOT_WAITING 0U
+#define NOTIFY_WAITING 1U
+#define NOTIFY_RECEIVED 2U
 
 /*--------------------------------------------------------------
                        PRIVATE TYPES
 --------------------------------------------------------------*/
 
-typedef std::chrono::duration<int, std::milli> milliseconds_type;
+#if configNUM_THREAD_LOCAL_STORAGE_POINTERS > 0 && configTHREAD_LOCAL_STORAGE_DELETE_CALLBACKS
+/** Same signature as TlsDeleteCallbackFunction_t from the ESP-IDF task.h */
+typedef void (*local_storage_delete_callback_t)(int, void *);
+#endif
 
 #if ESP_PLATFORM
 portMUX_TYPE global_mux = SPINLOCK_INITIALIZER;
 #endif
 
+#if configGENERATE_RUN_TIME_STATS && !configMOCK_FIBERS
+/** Host statistics of a task thread */
+typedef enum
+{
+    HOST_STATS_NONE, /*< The task has not entered its thread yet */
+    HOST_STATS_LIVE, /*< The task runs on its thread, the host is asked */
+    HOST_STATS_DONE, /*< The task left its thread, the statistics are frozen */
+} host_stats_state_t;
+#endif
+
+/**
+ * Notification values of a task. The state and the value of an entry share
+ * one atomic word, so notifying and taking a pending notification are a
+ * compare-and-swap each; only a task that has to wait goes through the kernel.
+ */
+class TaskNotifications
+{
+public:
+    /**
+     * Applies the action and wakes the task if it waits on the entry.
+     * @return false if eSetValueWithoutOverwrite found a notification pending
+     */
+    bool notify(InternalWaiter &waiter, UBaseType_t index, uint32_t value, eNotifyAction action, uint32_t *previous, bool *woken)
+    {
+        std::atomic<uint64_t> &entry = entries_[index];
+        uint64_t word = entry.load(std::memory_order_relaxed);
+        uint64_t updated;
+        bool stored;
+        /* seq_cst pairs with wait(): either the waiter sees the notification or this sees its sequence */
+        do
+        {
+            uint32_t notified = value_of(word);
+            stored = true;
+            switch (action)
+            {
+            case eSetBits:
+                notified |= value;
+                break;
+            case eIncrement:
+                notified++;
+                break;
+            case eSetValueWithOverwrite:
+                notified = value;
+                break;
+            case eSetValueWithoutOverwrite:
+                if (state_of(word) == NOTIFY_RECEIVED)
+                {
+                    stored = false;
+                }
+                else
+                {
+                    notified = value;
+                }
+                break;
+            case eNoAction:
+            default:
+                break;
+            }
+            updated = make_word(NOTIFY_RECEIVED, notified);
+        } while (!entry.compare_exchange_weak(word, updated, std::memory_order_seq_cst, std::memory_order_relaxed));
+
+        if (previous)
+        {
+            *previous = value_of(word);
+        }
+        const bool waiting = (state_of(word) == NOTIFY_WAITING);
+        if (waiting)
+        {
+            /* Only the wait published in sequence_ is woken, a later wait of the task is left alone */
+            InternalKernel::wake(waiter, sequence_.load(std::memory_order_seq_cst));
+        }
+        if (woken)
+        {
+            *woken = waiting;
+        }
+        return stored;
+    }
+
+    /** ulTaskNotifyTake(): the value before it is decremented or cleared */
+    uint32_t take(InternalWaiter &waiter, UBaseType_t index, bool clear, TickType_t ticks)
+    {
+        std::atomic<uint64_t> &entry = entries_[index];
+        uint64_t word = entry.load(std::memory_order_acquire);
+        /* Like tasks.c, only a zero count blocks */
+        while (ticks > 0 && value_of(word) == 0)
+        {
+            if (entry.compare_exchange_weak(word, make_word(NOTIFY_WAITING, 0), std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                wait(waiter, entry, ticks);
+                break;
+            }
+        }
+        word = entry.load(std::memory_order_acquire);
+        uint32_t taken;
+        do
+        {
+            taken = value_of(word);
+        } while (!entry.compare_exchange_weak(word, make_word(NOTIFY_NOT_WAITING, clear ? 0 : (taken ? taken - 1 : 0)),
+                                              std::memory_order_acq_rel, std::memory_order_acquire));
+        return taken;
+    }
+
+    /** xTaskNotifyWait(): true if a notification was received */
+    bool wait_bits(InternalWaiter &waiter, UBaseType_t index, uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *value, TickType_t ticks)
+    {
+        std::atomic<uint64_t> &entry = entries_[index];
+        uint64_t word = entry.load(std::memory_order_acquire);
+        while (state_of(word) != NOTIFY_RECEIVED)
+        {
+            if (entry.compare_exchange_weak(word, make_word(NOTIFY_WAITING, value_of(word) & ~clear_on_entry), std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                if (ticks > 0)
+                {
+                    wait(waiter, entry, ticks);
+                }
+                break;
+            }
+        }
+        word = entry.load(std::memory_order_acquire);
+        bool received;
+        do
+        {
+            received = (state_of(word) == NOTIFY_RECEIVED);
+            if (value)
+            {
+                *value = value_of(word);
+            }
+        } while (!entry.compare_exchange_weak(word, make_word(NOTIFY_NOT_WAITING, received ? value_of(word) & ~clear_on_exit : value_of(word)),
+                                              std::memory_order_acq_rel, std::memory_order_acquire));
+        return received;
+    }
+
+    /** xTaskNotifyStateClear(): true if a notification was pending */
+    bool clear_state(UBaseType_t index)
+    {
+        std::atomic<uint64_t> &entry = entries_[index];
+        uint64_t word = entry.load(std::memory_order_relaxed);
+        while (state_of(word) == NOTIFY_RECEIVED)
+        {
+            if (entry.compare_exchange_weak(word, make_word(NOTIFY_NOT_WAITING, value_of(word)), std::memory_order_acq_rel, std::memory_order_relaxed))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /** ulTaskNotifyValueClear(): the value before the bits were cleared */
+    uint32_t clear_bits(UBaseType_t index, uint32_t bits)
+    {
+        std::atomic<uint64_t> &entry = entries_[index];
+        uint64_t word = entry.load(std::memory_order_relaxed);
+        while (!entry.compare_exchange_weak(word, make_word(state_of(word), value_of(word) & ~bits), std::memory_order_acq_rel, std::memory_order_relaxed))
+        {
+        }
+        return value_of(word);
+    }
+
+private:
+    static uint64_t make_word(uint32_t state, uint32_t value)
+    {
+        return ((uint64_t)state << 32) | value;
+    }
+
+    static uint32_t state_of(uint64_t word)
+    {
+        return (uint32_t)(word >> 32);
+    }
+
+    static uint32_t value_of(uint64_t word)
+    {
+        return (uint32_t)word;
+    }
+
+    /** Blocks the calling task until the entry leaves the waiting state, or until the timeout */
+    void wait(InternalWaiter &waiter, std::atomic<uint64_t> &entry, TickType_t ticks)
+    {
+        const uint64_t deadline = InternalKernel::deadline_from_ticks(ticks);
+        while (true)
+        {
+            /* Published before the state is checked: a notifier that sees the task waiting wakes this wait.
+             * A store followed by a load of another location needs seq_cst, release/acquire lets them reorder */
+            InternalKernel::prepare(waiter);
+            sequence_.store(waiter.sequence, std::memory_order_seq_cst);
+            if (state_of(entry.load(std::memory_order_seq_cst)) != NOTIFY_WAITING)
+            {
+                return;
+            }
+            if (deadline != KERNEL_WAIT_FOREVER && InternalClock::ticks() >= deadline)
+            {
+                return;
+            }
+            InternalKernel::block(waiter, deadline);
+            if (waiter.interrupted())
+            {
+                InternalKernel::checkpoint();
+            }
+        }
+    }
+
+    std::atomic<uint64_t> entries_[configTASK_NOTIFICATION_ARRAY_ENTRIES];
+    /** Sequence of the wait the task is blocked in */
+    std::atomic<uint64_t> sequence_;
+};
+
+/** Completion signal of a vTaskDelete() call that waits for another task to go */
+struct DeletionRequest
+{
+    std::mutex mutex;
+    InternalCondition deleted;
+    bool done = false;
+    /** Task being deleted, cleared by the reaper once it is gone */
+    tskTaskControlBlock *target = nullptr;
+};
+
 struct tskTaskControlBlock
 {
 public:
     void run()
     {
+        InternalKernel::bind_waiter(&waiter);
+#if !configMOCK_FIBERS
+        /* Fibers share the host thread of the core */
         thread_id = pthread_self();
-        thread_started = true;
+        host_tid = InternalHost::thread_id();
+        apply_host_scheduling();
         pthread_setname_np(pthread_self(), _name.c_str());
+#if configGENERATE_RUN_TIME_STATS
+        host_stats_entry = InternalHost::thread_stats();
+        host_stats_state = HOST_STATS_LIVE;
+#endif
+#endif
+        /* High-water marks count from here, the host frames above are not the task's */
+        char top;
+        stack_top = &top;
+#if configMOCK_FIBERS
+        waiter.stack = &stack;
+#else
+        /* Also run when the task exits by unwinding */
+        struct ThreadRelease
+        {
+            tskTaskControlBlock &task;
+            ~ThreadRelease()
+            {
+                task.release_thread();
+            }
+        } release{*this};
+        waiter.stack = job.stack;
+#endif
+        InternalKernel::task_entry(waiter);
         taskCode(parameters);
+        InternalKernel::task_exited(waiter);
     }
 
-    void start(void)
+#if !configMOCK_FIBERS
+    /** A recycled thread moves on to other tasks, its stack and statistics are not this task's any more */
+    void release_thread(void)
     {
-        suspend_requested.unlock();
-        worker = std::thread(&tskTaskControlBlock::run, this);
+        waiter.stack = nullptr;
+#if configGENERATE_RUN_TIME_STATS
+        host_stats_exit = InternalHost::thread_stats();
+        host_stats_state = HOST_STATS_DONE;
+#endif
     }
+#endif
 
-    void process_events(void)
+    void apply_host_scheduling(void)
     {
-        if (!suspend_requested.try_lock())
+        std::unique_lock<std::mutex> lock(host_mutex);
+        thread_started = true;
+        InternalHost::set_priority(thread_id, host_tid, priority);
+        InternalHost::set_core(thread_id, core_id);
+    }
+
+    /** Puts a priority in effect in the scheduler and on the host thread, host_mutex must be held */
+    void apply_priority(UBaseType_t new_priority)
+    {
+        priority = new_priority;
+        InternalKernel::set_priority(waiter, new_priority);
+#if !configMOCK_FIBERS
+        if (thread_started)
         {
-            task_suspended.notify_all();
-            suspend_requested.lock();
+            InternalHost::set_priority(thread_id, host_tid, new_priority);
         }
-        suspend_requested.unlock();
+#endif
+    }
 
-        if (!delete_requested.try_lock())
+    void set_priority(UBaseType_t new_priority)
+    {
+        std::unique_lock<std::mutex> lock(host_mutex);
+        /* An inherited priority stays in effect until the mutexes are given back, unless the new one is higher */
+        if (base_priority == priority || new_priority > priority)
         {
-            stop();
+            apply_priority(new_priority);
         }
-        delete_requested.unlock();
+        base_priority = new_priority;
     }
 
-    void suspend(void)
+    /** Raises the priority to the one of a task waiting for a mutex this task holds */
+    bool inherit(UBaseType_t waiting_priority)
     {
-        if (thread_suspended)
+        std::unique_lock<std::mutex> lock(host_mutex);
+        if (priority < waiting_priority)
         {
-            return;
+            apply_priority(waiting_priority);
+            return true;
         }
-        thread_suspended = true;
-        if (suspend_requested.try_lock())
+        /* Already running high enough, but only because of an earlier inheritance */
+        return base_priority < waiting_priority;
+    }
+
+    /** A held mutex was given back, drops the inherited priority once no mutex is held any more */
+    bool disinherit(void)
+    {
+        std::unique_lock<std::mutex> lock(host_mutex);
+        if (mutexes_held > 0)
         {
-            std::unique_lock<std::mutex> lock_suspended(task_suspended_mutex);
-            milliseconds_type duration(WAIT_FOR_TASK_SUSPENDED_TIMEOUT);
-            if (task_suspended.wait_for(lock_suspended, duration) == std::cv_status::timeout)
-            {
-                std::cout << "Error waiting for task suspention";
-            }
+            mutexes_held--;
         }
+        if (priority == base_priority || mutexes_held > 0)
+        {
+            return false;
+        }
+        apply_priority(base_priority);
+        return true;
     }
 
-    void resume(void)
+    /** A task that raised the priority stopped waiting, falls back to the highest priority still waiting */
+    void disinherit_after_timeout(UBaseType_t highest_waiting)
     {
-        thread_suspended = false;
-        suspend_requested.unlock();
+        std::unique_lock<std::mutex> lock(host_mutex);
+        const UBaseType_t target = highest_waiting > base_priority ? highest_waiting : base_priority.load();
+        /* With other mutexes held it is not known which waiters the priority is owed to, so it stays */
+        if (priority != target && mutexes_held == 1)
+        {
+            apply_priority(target);
+        }
     }
 
-    void exit(void)
+    bool start(void)
     {
-        pthread_exit(0);
+        waiter.task = this;
+#if configMOCK_FIBERS
+        if (usable_stack_buffer())
+        {
+            stack.borrow(stack_buffer, stack_bytes());
+        }
+        else if (!stack.allocate(host_stack_size()))
+        {
+            return false;
+        }
+        if (!fiber.create(stack, &tskTaskControlBlock::entry, this))
+        {
+            return false;
+        }
+        waiter.fiber = &fiber;
+        thread_started = true;
+        InternalKernel::task_started(waiter, priority, core_id);
+#else
+        InternalKernel::task_started(waiter, priority, core_id);
+        job.entry = &tskTaskControlBlock::entry;
+        job.arg = this;
+        job.stack_buffer = usable_stack_buffer();
+        job.stack_size = job.stack_buffer ? stack_bytes() : host_stack_size();
+        if (!InternalThreadPool::start(job))
+        {
+            InternalKernel::task_exited(waiter);
+            return false;
+        }
+#endif
+        return true;
     }
 
-    void stop(void)
+    static void entry(void *task)
     {
-        if (thread_started)
+        static_cast<tskTaskControlBlock *>(task)->run();
+    }
+
+    size_t stack_bytes(void) const
+    {
+        return stack_depth * sizeof(StackType_t);
+    }
+
+    /** Host library calls need more stack than MCU code, the depth is raised to the minimum */
+    size_t host_stack_size(void) const
+    {
+        return std::max<size_t>(stack_bytes(), configMOCK_MIN_STACK_SIZE);
+    }
+
+    /** The application buffer is only run on if it is at least the minimum size */
+    StackType_t *usable_stack_buffer(void) const
+    {
+        return (stack_bytes() >= configMOCK_MIN_STACK_SIZE) ? stack_buffer : nullptr;
+    }
+
+    /** Host CPU time the task has used (configGENERATE_RUN_TIME_STATS) */
+    uint64_t run_time_ns(void)
+    {
+#if !configGENERATE_RUN_TIME_STATS
+        return 0;
+#elif configMOCK_FIBERS
+        return waiter.cpu_ns;
+#else
+        const host_stats_state_t state = host_stats_state;
+        if (state == HOST_STATS_NONE)
         {
-            if (thread_id == pthread_self())
-            {
-                exit();
-            }
-            else
-            {
-                delete_requested.lock();
-                worker.join();
-            }
-            thread_started = false;
+            return 0;
         }
-        else
+        const uint64_t now = (state == HOST_STATS_LIVE) ? InternalHost::cpu_time(thread_id) : host_stats_exit.cpu_ns;
+        return now - host_stats_entry.cpu_ns;
+#endif
+    }
+
+    /** Emulated task switches with configMOCK_SCHEDULER, the switches of the host thread otherwise */
+    void context_switches(uint32_t &voluntary, uint32_t &involuntary)
+    {
+        voluntary = 0;
+        involuntary = 0;
+#if configGENERATE_RUN_TIME_STATS && configMOCK_SCHEDULER
+        voluntary = waiter.voluntary_switches;
+        involuntary = waiter.involuntary_switches;
+#elif configGENERATE_RUN_TIME_STATS
+        const host_stats_state_t state = host_stats_state;
+        if (state == HOST_STATS_NONE)
         {
-            abort();
+            return;
+        }
+        const InternalHost::ThreadStats now = (state == HOST_STATS_LIVE) ? InternalHost::thread_stats(thread_id, host_tid) : host_stats_exit;
+        voluntary = now.voluntary_switches - host_stats_entry.voluntary_switches;
+        involuntary = now.involuntary_switches - host_stats_entry.involuntary_switches;
+#endif
+    }
+
+    /** Least stack left, in words of usStackDepth, since the task function was entered */
+    configSTACK_DEPTH_TYPE high_water_mark(void) const
+    {
+        InternalStack *current = waiter.stack;
+        const char *top = stack_top;
+        if (!current || !top)
+        {
+            return (configSTACK_DEPTH_TYPE)stack_depth;
         }
+        const size_t used = top - current->deepest();
+        return (used >= stack_bytes()) ? 0 : (configSTACK_DEPTH_TYPE)((stack_bytes() - used) / sizeof(StackType_t));
+    }
+
+    /** A blocked task parks as soon as its wait ends, a running one at its next kernel call */
+    void suspend(void)
+    {
+        InternalKernel::suspend(waiter);
+    }
+
+    bool resume(void)
+    {
+        return InternalKernel::resume(waiter);
+    }
+
+    /** Called by the reaper, the task leaves its waits and exits at its next kernel call */
+    void stop(void)
+    {
+        InternalKernel::kill(waiter);
+#if configMOCK_FIBERS
+        InternalKernel::join(waiter);
+#else
+        InternalThreadPool::join(job);
+#endif
+        InternalKernel::task_exited(waiter);
+        thread_started = false;
     }
 
     void setObjectName(const char *name)
     {
-        _name = std::string(name);
+        /* Names are stored truncated the same way the kernel does it */
+        _name = std::string(name ? name : "").substr(0, configMAX_TASK_NAME_LEN - 1);
     }
 
     TaskFunction_t taskCode;
     void *parameters;
     TaskHandle_t *createdTask;
-    std::condition_variable task_suspended;
-    std::mutex task_suspended_mutex;
+    /** Priority in effect, may be inherited from a task waiting for a mutex */
+    std::atomic<UBaseType_t> priority;
+    /** Priority last assigned to the task */
+    std::atomic<UBaseType_t> base_priority;
+    /** Mutexes taken and not given back yet, guarded by host_mutex */
+    UBaseType_t mutexes_held;
+    BaseType_t core_id;
+    configSTACK_DEPTH_TYPE stack_depth;
+    /** xTaskCreateStatic() buffer, NULL for a dynamic task */
+    StackType_t *stack_buffer;
+    /** Stack pointer at the task function entry */
+    std::atomic<const char *> stack_top;
+    UBaseType_t task_number;
+    std::atomic<bool> thread_deleted;
+#if configNUM_THREAD_LOCAL_STORAGE_POINTERS > 0
+    void *local_storage[configNUM_THREAD_LOCAL_STORAGE_POINTERS];
+#if configTHREAD_LOCAL_STORAGE_DELETE_CALLBACKS
+    local_storage_delete_callback_t local_storage_delete[configNUM_THREAD_LOCAL_STORAGE_POINTERS];
+#endif
+#endif
+    InternalWaiter waiter;
+    TaskNotifications notifications;
+    /** xTaskDelayUntil() calls that found their wake time passed already */
+    std::atomic<uint32_t> missed_deadlines;
+    /** Longest time xTaskDelayUntil() returned after the wake time, in microseconds of host time */
+    std::atomic<uint32_t> max_wake_latency_us;
 
     pthread_t thread_id;
+    pid_t host_tid;
+    /** Serializes the host priority updates against the thread start */
+    std::mutex host_mutex;
     std::atomic<bool> thread_started;
-    std::atomic<bool> thread_suspended;
-    std::thread worker;
+    InternalThreadPool::Job job;
+#if configGENERATE_RUN_TIME_STATS && !configMOCK_FIBERS
+    /** A pool thread may have run other tasks before, the task only counts from its entry */
+    InternalHost::ThreadStats host_stats_entry;
+    InternalHost::ThreadStats host_stats_exit;
+    std::atomic<host_stats_state_t> host_stats_state;
+#endif
+#if configMOCK_FIBERS
+    InternalStack stack;
+    InternalFiber fiber;
+#endif
     std::string _name;
-    std::mutex suspend_requested;
-    std::mutex delete_requested;
+    /** Link of the pending deletion queue */
+    tskTaskControlBlock *delete_next;
+    /** Request of the vTaskDelete() call that waits for this task to go, if any */
+    DeletionRequest *deleted_by;
+    /** Completion signal of the vTaskDelete() calls made by this task */
+    DeletionRequest deletion;
+
+    /** TCB memory is recycled, see configMOCK_TASK_POOL_SIZE */
+    static void *operator new(size_t size);
+    static void operator delete(void *memory);
+};
+
+/** Registry of the live tasks with O(1) lookup by handle slot and by name */
+class TaskRegistry
+{
+public:
+    void add(tskTaskControlBlock *task)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (free_slots_.empty())
+        {
+            task->task_number = slots_.size();
+            slots_.push_back(task);
+        }
+        else
+        {
+            task->task_number = free_slots_.back();
+            free_slots_.pop_back();
+            slots_[task->task_number] = task;
+        }
+        names_.emplace(task->_name, task);
+        live_.insert(task);
+        count_++;
+    }
+
+    bool remove(tskTaskControlBlock *task)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!contains_locked(task))
+        {
+            return false;
+        }
+        slots_[task->task_number] = nullptr;
+        free_slots_.push_back(task->task_number);
+        auto range = names_.equal_range(task->_name);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (it->second == task)
+            {
+                names_.erase(it);
+                break;
+            }
+        }
+        live_.erase(task);
+        count_--;
+        return true;
+    }
+
+    bool contains(tskTaskControlBlock *task)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return contains_locked(task);
+    }
+
+    tskTaskControlBlock *find(const char *name)
+    {
+        std::string key = std::string(name).substr(0, configMAX_TASK_NAME_LEN - 1);
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto it = names_.find(key);
+        return (it == names_.end()) ? nullptr : it->second;
+    }
+
+    UBaseType_t count(void)
+    {
+        return count_.load();
+    }
+
+    /** Calls func for the task if it is live, the registry stays locked meanwhile */
+    template <typename Func>
+    bool visit(tskTaskControlBlock *task, Func func)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!contains_locked(task))
+        {
+            return false;
+        }
+        func(task);
+        return true;
+    }
+
+    /** Calls func for every live task, the registry stays locked meanwhile */
+    template <typename Func>
+    void for_each(Func func)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (auto task : slots_)
+        {
+            if (task)
+            {
+                func(task);
+            }
+        }
+    }
+
+private:
+    bool contains_locked(tskTaskControlBlock *task)
+    {
+        /* The handle is only hashed, never dereferenced, before it is known to be live */
+        return live_.count(task) != 0;
+    }
+
+    std::mutex mutex_;
+    std::vector<tskTaskControlBlock *> slots_;
+    std::vector<UBaseType_t> free_slots_;
+    std::unordered_multimap<std::string, tskTaskControlBlock *> names_;
+    std::unordered_set<tskTaskControlBlock *> live_;
+    std::atomic<UBaseType_t> count_{0};
 };
 
 /*--------------------------------------------------------------
                        PRIVATE DATA
 --------------------------------------------------------------*/
 
-static std::condition_variable tasks_deleted;
 static std::condition_variable request_task_deletion;
-static std::mutex task_deletion_mutex;
 static std::mutex task_management_mutex;
-static std::list<tskTaskControlBlock *> thread_list = std::list<tskTaskControlBlock *>();
-static std::list<tskTaskControlBlock *> deleted_thread_list = std::list<tskTaskControlBlock *>();
+static TaskRegistry task_registry;
+/** Lock-free stack of the tasks to reap, linked through delete_next */
+static std::atomic<tskTaskControlBlock *> pending_deletions(nullptr);
+static std::mutex tcb_pool_mutex;
+static std::vector<void *> free_tcbs;
+static TaskHandle_t idle_tasks[configNUM_CORES];
+/** Zero of the run-time counter */
+static const std::chrono::steady_clock::time_point run_time_origin = std::chrono::steady_clock::now();
+
+/*--------------------------------------------------------------
+                      PRIVATE FUNCTIONS
+--------------------------------------------------------------*/
+
+void *tskTaskControlBlock::operator new(size_t size)
+{
+#if configMOCK_TASK_POOL_SIZE > 0
+    {
+        std::unique_lock<std::mutex> lock(tcb_pool_mutex);
+        if (!free_tcbs.empty())
+        {
+            void *memory = free_tcbs.back();
+            free_tcbs.pop_back();
+            return memory;
+        }
+    }
+#endif
+    return ::operator new(size);
+}
+
+void tskTaskControlBlock::operator delete(void *memory)
+{
+#if configMOCK_TASK_POOL_SIZE > 0
+    {
+        std::unique_lock<std::mutex> lock(tcb_pool_mutex);
+        if (free_tcbs.size() < configMOCK_TASK_POOL_SIZE)
+        {
+            free_tcbs.push_back(memory);
+            return;
+        }
+    }
+#endif
+    ::operator delete(memory);
+}
+
+/** The emulated cores idle on the host, the idle tasks only provide their handles */
+static void prvIdleTask(void *parameters)
+{
+    (void)parameters;
+    while (true)
+    {
+        vTaskDelay(portMAX_DELAY);
+    }
+}
+
+static bool prvIsIdleTask(TaskHandle_t task)
+{
+    return std::find(std::begin(idle_tasks), std::end(idle_tasks), task) != std::end(idle_tasks);
+}
+
+static void prvDeleteLocalStorage(tskTaskControlBlock *task)
+{
+#if configNUM_THREAD_LOCAL_STORAGE_POINTERS > 0 && configTHREAD_LOCAL_STORAGE_DELETE_CALLBACKS
+    for (int i = 0; i < configNUM_THREAD_LOCAL_STORAGE_POINTERS; i++)
+    {
+        if (task->local_storage_delete[i])
+        {
+            task->local_storage_delete[i](i, task->local_storage[i]);
+        }
+    }
+#endif
+}
+
+/** Queues a task for the reaper, every task is queued once (see thread_deleted) */
+static void prvQueueDeletion(tskTaskControlBlock *task)
+{
+    tskTaskControlBlock *head = pending_deletions.load(std::memory_order_relaxed);
+    do
+    {
+        task->delete_next = head;
+    } while (!pending_deletions.compare_exchange_weak(head, task, std::memory_order_release, std::memory_order_relaxed));
+    if (!head)
+    {
+        /* The reaper only sleeps on an empty queue */
+        std::unique_lock<std::mutex> lock(task_management_mutex);
+        request_task_deletion.notify_one();
+    }
+}
+
+/** Waits for deletion requests and takes all of them, oldest first */
+static tskTaskControlBlock *prvTakeDeletions(void)
+{
+    {
+        std::unique_lock<std::mutex> lock(task_management_mutex);
+        request_task_deletion.wait(lock, []()
+                                   {
+                                       return pending_deletions.load(std::memory_order_relaxed) != nullptr;
+                                   });
+    }
+    tskTaskControlBlock *task = pending_deletions.exchange(nullptr, std::memory_order_acquire);
+    tskTaskControlBlock *oldest = nullptr;
+    while (task)
+    {
+        tskTaskControlBlock *next = task->delete_next;
+        task->delete_next = oldest;
+        oldest = task;
+        task = next;
+    }
+    return oldest;
+}
+
+static void prvReap(tskTaskControlBlock *thread)
+{
+    /* The stack of a recycled thread must not be looked at for this task any more */
+    task_registry.remove(thread);
+    thread->stop();
+    if (thread->deletion.target)
+    {
+        /* The task died waiting for another deletion, nobody is left to signal */
+        thread->deletion.target->deleted_by = nullptr;
+    }
+    DeletionRequest *request = thread->deleted_by;
+    prvDeleteLocalStorage(thread);
+    delete thread;
+    if (request)
+    {
+        std::unique_lock<std::mutex> lock(request->mutex);
+        request->target = nullptr;
+        request->done = true;
+        request->deleted.notify_all();
+    }
+}
+
+/** xTaskCreate() of both kinds, stack_buffer is NULL for a dynamic task */
+static BaseType_t prvCreateTask(TaskFunction_t pvTaskCode,
+                                const char *const pcName,
+                                const configSTACK_DEPTH_TYPE usStackDepth,
+                                void *const pvParameters,
+                                UBaseType_t uxPriority,
+                                TaskHandle_t *const pvCreatedTask,
+                                const BaseType_t xCoreID,
+                                StackType_t *const stack_buffer)
+{
+    tskTaskControlBlock *thread = new tskTaskControlBlock();
+
+    thread->taskCode = pvTaskCode;
+    thread->parameters = pvParameters;
+    thread->createdTask = pvCreatedTask;
+    thread->priority = std::min<UBaseType_t>(uxPriority, configMAX_PRIORITIES - 1);
+    thread->base_priority = thread->priority.load();
+    thread->mutexes_held = 0;
+    thread->core_id = xCoreID;
+    thread->stack_depth = usStackDepth;
+    thread->stack_buffer = stack_buffer;
+    thread->thread_deleted = false;
+    thread->delete_next = nullptr;
+    thread->deleted_by = nullptr;
+#if configNUM_THREAD_LOCAL_STORAGE_POINTERS > 0
+    for (int i = 0; i < configNUM_THREAD_LOCAL_STORAGE_POINTERS; i++)
+    {
+        thread->local_storage[i] = NULL;
+#if configTHREAD_LOCAL_STORAGE_DELETE_CALLBACKS
+        thread->local_storage_delete[i] = NULL;
+#endif
+    }
+#endif
+    thread->setObjectName(pcName);
+
+    task_registry.add(thread);
+
+    /* The handle must be valid before the task gets a chance to use it */
+    if (pvCreatedTask)
+    {
+        *pvCreatedTask = thread;
+    }
+    if (!thread->start())
+    {
+        task_registry.remove(thread);
+        if (pvCreatedTask)
+        {
+            *pvCreatedTask = NULL;
+        }
+        delete thread;
+        return errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY;
+    }
+    InternalKernel::yield();
+
+    return pdPASS;
+}
+
+/** Must be called for a live task only (from inside the registry) */
+static eTaskState prvGetState(tskTaskControlBlock *thread)
+{
+    if (thread->thread_deleted)
+    {
+        return eDeleted;
+    }
+    if (thread == xTaskGetCurrentTaskHandle())
+    {
+        return eRunning;
+    }
+    if (thread->waiter.suspended)
+    {
+        return eSuspended;
+    }
+    if (InternalKernel::blocked(thread->waiter))
+    {
+        return eBlocked;
+    }
+    if (thread->thread_started)
+    {
+        return eReady;
+    }
+    return eInvalid;
+}
+
+static uint64_t prvRunTimeUs(void)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - run_time_origin).count();
+}
+
+#if configGENERATE_RUN_TIME_STATS
+/** Host CPU time of the tasks on every core in microseconds, unpinned tasks count for all cores evenly */
+static void prvBusyTimes(uint64_t (&busy_us)[configNUM_CORES])
+{
+    uint64_t floating_us = 0;
+    std::fill(std::begin(busy_us), std::end(busy_us), 0);
+    task_registry.for_each([&](tskTaskControlBlock *thread)
+                           {
+                               if (prvIsIdleTask(thread))
+                               {
+                                   return;
+                               }
+                               const uint64_t run_us = thread->run_time_ns() / 1000;
+                               if (thread->core_id >= 0 && thread->core_id < configNUM_CORES)
+                               {
+                                   busy_us[thread->core_id] += run_us;
+                               }
+                               else
+                               {
+                                   floating_us += run_us;
+                               }
+                           });
+    for (auto &core_us : busy_us)
+    {
+        core_us += floating_us / configNUM_CORES;
+    }
+}
+
+/** The emulated cores idle on the host, so an idle task is given the time its core did not use */
+static uint32_t prvIdleRunTime(BaseType_t core, const uint64_t (&busy_us)[configNUM_CORES], uint64_t elapsed_us)
+{
+    return (uint32_t)((elapsed_us > busy_us[core]) ? elapsed_us - busy_us[core] : 0);
+}
+#endif
+
+/** Copies the name and pads it with spaces to configMAX_TASK_NAME_LEN like tasks.c does for the tables */
+static char *prvWriteNameToBuffer(char *buffer, const char *name)
+{
+    strcpy(buffer, name);
+    size_t length = strlen(buffer);
+    while (length < (size_t)(configMAX_TASK_NAME_LEN - 1))
+    {
+        buffer[length++] = ' ';
+    }
+    buffer[length] = '\0';
+    return buffer + length;
+}
+
+/** Snapshot of the live tasks for the formatted reports */
+static std::vector<TaskStatus_t> prvSystemState(uint32_t *total_run_time)
+{
+    /* A few spare entries for tasks created meanwhile */
+    std::vector<TaskStatus_t> tasks(uxTaskGetNumberOfTasks() + 4);
+    tasks.resize(uxTaskGetSystemState(tasks.data(), tasks.size(), total_run_time));
+    return tasks;
+}
 
 /*--------------------------------------------------------------
                       PUBLIC FUNCTIONS
@@ -163,38 +998,90 @@ static std::list<tskTaskControlBlock *> deleted_thread_list = std::list<tskTaskC
 
 extern "C" void vTaskStartScheduler(void)
 {
-    std::list<tskTaskControlBlock *> deleted_thread_list_copy;
-    std::list<tskTaskControlBlock *> thread_list_copy;
+    for (BaseType_t core = 0; core < configNUM_CORES; core++)
+    {
+        char name[configMAX_TASK_NAME_LEN];
+        if (configNUM_CORES > 1)
+        {
+            snprintf(name, sizeof(name), "%s%d", configIDLE_TASK_NAME, (int)core);
+        }
+        else
+        {
+            snprintf(name, sizeof(name), "%s", configIDLE_TASK_NAME);
+        }
+        xTaskCreatePinnedToCore(prvIdleTask, name, configMINIMAL_STACK_SIZE, NULL, tskIDLE_PRIORITY, &idle_tasks[core], core);
+    }
+    InternalHost::pin_helper();
+#if !configMOCK_FIBERS
+    InternalThreadPool::reserve(configMOCK_TASK_POOL_SIZE, configMOCK_MIN_STACK_SIZE);
+#endif
+    InternalKernel::start();
+
     while (true)
     {
-        std::unique_lock<std::mutex> lock_del(task_deletion_mutex);
-        request_task_deletion.wait(lock_del);
-        {
-            std::unique_lock<std::mutex> lock_man(task_management_mutex);
-            deleted_thread_list_copy = deleted_thread_list;
-            thread_list_copy = thread_list;
-        }
-        for (auto thread : deleted_thread_list_copy)
+        tskTaskControlBlock *thread = prvTakeDeletions();
+        while (thread)
         {
-            bool found = (std::find(thread_list_copy.begin(), thread_list_copy.end(), thread) != thread_list_copy.end());
-            if (found)
-            {
-                thread->stop();
-                delete thread;
-                std::unique_lock<std::mutex> lock_man(task_management_mutex);
-                thread_list.remove(thread);
-            }
+            tskTaskControlBlock *next = thread->delete_next;
+            prvReap(thread);
+            thread = next;
         }
-        tasks_deleted.notify_one();
-    };
+    }
 }
 
 extern "C" void vTaskDelay(const TickType_t xTicksToDelay)
 {
+    InternalKernel::delay(xTicksToDelay);
+}
+
+extern "C" BaseType_t xTaskDelayUntil(TickType_t *const pxPreviousWakeTime, const TickType_t xTimeIncrement)
+{
+    if (!pxPreviousWakeTime || xTimeIncrement == 0)
+    {
+        abort();
+    }
+    const uint64_t now = InternalClock::ticks();
+    const TickType_t now_count = (TickType_t)now;
+    const TickType_t previous = *pxPreviousWakeTime;
+    const TickType_t wake_count = previous + xTimeIncrement;
+    /* The same wrap-around cases of the tick count as in tasks.c */
+    bool should_delay;
+    if (now_count < previous)
+    {
+        should_delay = (wake_count < previous) && (wake_count > now_count);
+    }
+    else
+    {
+        should_delay = (wake_count < previous) || (wake_count > now_count);
+    }
+    *pxPreviousWakeTime = wake_count;
+
     tskTaskControlBlock *task = xTaskGetCurrentTaskHandle();
-    task->process_events();
-    TickType_t ticks = xTicksToDelay;
-    usleep(pdTICKS_TO_MS(ticks) * 1000);
+    if (!should_delay)
+    {
+        if (task)
+        {
+            task->missed_deadlines++;
+        }
+        InternalKernel::yield();
+        return pdFALSE;
+    }
+    /* The wake time is kept as an absolute tick, so the time spent by the loop body does not add up */
+    const uint64_t deadline = now + (TickType_t)(wake_count - now_count);
+    InternalKernel::delay_until(deadline);
+    if (task)
+    {
+#if !configMOCK_VIRTUAL_TIME
+        const uint64_t wake_ns = InternalClock::tick_to_time_ns(deadline);
+        const uint64_t now_ns = port_get_time_ns();
+        const uint32_t latency_us = (uint32_t)std::min<uint64_t>((now_ns > wake_ns) ? (now_ns - wake_ns) / 1000 : 0, UINT32_MAX);
+        if (latency_us > task->max_wake_latency_us)
+        {
+            task->max_wake_latency_us = latency_us;
+        }
+#endif
+    }
+    return pdTRUE;
 }
 
 extern "C" BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode,
@@ -205,25 +1092,7 @@ extern "C" BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode,
                                               TaskHandle_t *const pvCreatedTask,
                                               const BaseType_t xCoreID)
 {
-    tskTaskControlBlock *thread = new tskTaskControlBlock();
-
-    thread->taskCode = pvTaskCode;
-    thread->parameters = pvParameters;
-    thread->createdTask = pvCreatedTask;
-    thread->setObjectName(pcName);
-
-    {
-        std::unique_lock<std::mutex> lk(task_management_mutex);
-        thread_list.push_back(thread);
-    }
-
-    thread->start();
-    if (pvCreatedTask)
-    {
-        *pvCreatedTask = thread;
-    }
-
-    return pdPASS;
+    return prvCreateTask(pvTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pvCreatedTask, xCoreID, NULL);
 }
 
 extern "C" TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t pvTaskCode,
@@ -235,8 +1104,9 @@ extern "C" TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t pvTaskCode,
                                                       StaticTask_t *const pxTaskBuffer,
                                                       const BaseType_t xCoreID)
 {
+    (void)pxTaskBuffer;
     TaskHandle_t pvCreatedTask;
-    xTaskCreatePinnedToCore(pvTaskCode, pcName, ulStackDepth, pvParameters, uxPriority, &pvCreatedTask, xCoreID);
+    prvCreateTask(pvTaskCode, pcName, ulStackDepth, pvParameters, uxPriority, &pvCreatedTask, xCoreID, pxStackBuffer);
     return pvCreatedTask;
 }
 
@@ -247,148 +1117,383 @@ extern "C" BaseType_t xTaskCreate(TaskFunction_t pxTaskCode,
                                   UBaseType_t uxPriority,
                                   TaskHandle_t *const pxCreatedTask)
 {
-    return xTaskCreatePinnedToCore(pxTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pxCreatedTask, 0);
+    return xTaskCreatePinnedToCore(pxTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pxCreatedTask, tskNO_AFFINITY);
 }
 
 extern "C" void vTaskDelete(TaskHandle_t xTaskToDelete)
 {
-    bool delete_self = false;
+    tskTaskControlBlock *self = xTaskGetCurrentTaskHandle();
     if (!xTaskToDelete)
     {
-        xTaskToDelete = xTaskGetCurrentTaskHandle();
+        xTaskToDelete = self;
         if (!xTaskToDelete)
         {
             abort();
         }
-        delete_self = true;
-    }
-    {
-        std::unique_lock<std::mutex> lk(task_management_mutex);
-        deleted_thread_list.push_back(xTaskToDelete);
-        request_task_deletion.notify_one();
     }
-    if (delete_self)
+    if (xTaskToDelete == self)
     {
-        while (1)
+        /* The reaper frees the TCB after the task is gone, nothing runs here any more */
+        if (!self->thread_deleted.exchange(true))
         {
-            /* Wait until deleted */
-            xTaskToDelete->process_events();
+            prvQueueDeletion(self);
         }
+        InternalKernel::exit_task();
     }
-    else
+    if (xTaskToDelete->thread_deleted.exchange(true))
+    {
+        /* Already on its way out */
+        return;
+    }
+
+    /* Threads that are not tasks cannot be deleted while they wait, so a local request will do */
+    DeletionRequest local_request;
+    DeletionRequest &request = self ? self->deletion : local_request;
     {
-        std::unique_lock<std::mutex> lk(task_management_mutex);
-        tasks_deleted.wait(lk);
+        std::unique_lock<std::mutex> lock(request.mutex);
+        request.done = false;
     }
+    request.target = xTaskToDelete;
+    xTaskToDelete->deleted_by = &request;
+    prvQueueDeletion(xTaskToDelete);
+
+    std::unique_lock<std::mutex> lock(request.mutex);
+    request.deleted.wait(lock, portMAX_DELAY, [&request]()
+                         {
+                             return request.done;
+                         });
 }
 
 extern "C" void terminateAllTasks(void)
 {
-    std::unique_lock<std::mutex> lk(task_management_mutex);
-    for (auto thread : thread_list)
-    {
-        deleted_thread_list.push_back(thread);
-    }
-    request_task_deletion.notify_one();
+    task_registry.for_each([](tskTaskControlBlock *thread)
+                           {
+                               /* Idle tasks live as long as the scheduler */
+                               if (prvIsIdleTask(thread) || thread->thread_deleted.exchange(true))
+                               {
+                                   return;
+                               }
+                               prvQueueDeletion(thread);
+                           });
 }
 
 extern "C" TickType_t xTaskGetTickCount(void)
 {
-    return pdMS_TO_TICKS(port_get_time_ms());
+    InternalKernel::yield();
+    return InternalClock::tick_count();
 }
 
 extern "C" TickType_t xTaskGetTickCountFromISR(void)
 {
-    return xTaskGetTickCount();
+    return InternalClock::tick_count();
 }
 
 extern "C" void vTaskSuspend(TaskHandle_t xTaskToSuspend)
 {
-    /* This will only suspend the task on the next sleep call */
-    xTaskToSuspend->suspend();
+    tskTaskControlBlock *thread = xTaskToSuspend ? xTaskToSuspend : xTaskGetCurrentTaskHandle();
+    if (!thread)
+    {
+        return;
+    }
+    thread->suspend();
+    InternalKernel::yield();
+}
+
+extern "C" void vTaskPrioritySet(TaskHandle_t xTask, UBaseType_t uxNewPriority)
+{
+    tskTaskControlBlock *thread = xTask ? xTask : xTaskGetCurrentTaskHandle();
+    if (!thread)
+    {
+        return;
+    }
+    thread->set_priority(std::min<UBaseType_t>(uxNewPriority, configMAX_PRIORITIES - 1));
+    InternalKernel::yield();
+}
+
+extern "C" UBaseType_t uxTaskPriorityGet(const TaskHandle_t xTask)
+{
+    tskTaskControlBlock *thread = xTask ? xTask : xTaskGetCurrentTaskHandle();
+    return thread ? thread->priority.load() : tskIDLE_PRIORITY;
+}
+
+extern "C" UBaseType_t uxTaskPriorityGetFromISR(const TaskHandle_t xTask)
+{
+    return uxTaskPriorityGet(xTask);
+}
+
+extern "C" TaskHandle_t pvTaskIncrementMutexHeldCount(void)
+{
+    tskTaskControlBlock *thread = xTaskGetCurrentTaskHandle();
+    if (thread)
+    {
+        std::unique_lock<std::mutex> lock(thread->host_mutex);
+        thread->mutexes_held++;
+    }
+    return thread;
+}
+
+extern "C" BaseType_t xTaskPriorityInherit(TaskHandle_t const pxMutexHolder)
+{
+    tskTaskControlBlock *self = xTaskGetCurrentTaskHandle();
+    if (!pxMutexHolder || !self)
+    {
+        return pdFALSE;
+    }
+    return pxMutexHolder->inherit(self->priority) ? pdTRUE : pdFALSE;
+}
+
+extern "C" BaseType_t xTaskPriorityDisinherit(TaskHandle_t const pxMutexHolder)
+{
+    if (!pxMutexHolder)
+    {
+        return pdFALSE;
+    }
+    return pxMutexHolder->disinherit() ? pdTRUE : pdFALSE;
+}
+
+extern "C" void vTaskPriorityDisinheritAfterTimeout(TaskHandle_t const pxMutexHolder,
+                                                    UBaseType_t uxHighestPriorityWaitingTask)
+{
+    if (pxMutexHolder)
+    {
+        pxMutexHolder->disinherit_after_timeout(uxHighestPriorityWaitingTask);
+    }
 }
 
 extern "C" void vTaskResume(TaskHandle_t xTaskToResume)
 {
     xTaskToResume->resume();
+    InternalKernel::yield();
 }
 
-extern "C" void vTaskSuspendAll(void)
+extern "C" BaseType_t xTaskResumeFromISR(TaskHandle_t xTaskToResume)
 {
-    std::unique_lock<std::mutex> lk(task_management_mutex);
-    for (auto thread : thread_list)
+    /* Interrupts are not preempted by tasks, a yield is up to the caller */
+    if (!xTaskToResume->resume())
     {
-        if (thread->thread_id == pthread_self())
-        {
-            thread->suspend();
-        }
+        return pdFALSE;
     }
+    return xTaskToResume->priority >= uxTaskPriorityGet(NULL) ? pdTRUE : pdFALSE;
+}
+
+extern "C" void vTaskSuspendAll(void)
+{
+    /* Keeps the run token, there is no preemption to stop in the free running mode */
+    InternalKernel::suspend_all();
+}
+
+extern "C" BaseType_t xTaskResumeAll(void)
+{
+    return InternalKernel::resume_all() ? pdTRUE : pdFALSE;
+}
+
+extern "C" void vPortYield(void)
+{
+    InternalKernel::yield(true);
 }
 
 extern "C" TaskHandle_t xTaskGetCurrentTaskHandle(void)
 {
-    std::unique_lock<std::mutex> lk(task_management_mutex);
-    for (auto thread : thread_list)
+    return static_cast<tskTaskControlBlock *>(InternalKernel::current_waiter().task);
+}
+
+extern "C" TaskHandle_t xTaskGetHandle(const char *pcNameToQuery)
+{
+    if (!pcNameToQuery)
     {
-        if (thread->thread_id == pthread_self())
-        {
-            return thread;
-        }
+        return NULL;
+    }
+    return task_registry.find(pcNameToQuery);
+}
+
+extern "C" char *pcTaskGetName(TaskHandle_t xTaskToQuery)
+{
+    tskTaskControlBlock *thread = xTaskToQuery ? xTaskToQuery : xTaskGetCurrentTaskHandle();
+    if (!thread)
+    {
+        return NULL;
+    }
+    return &thread->_name[0];
+}
+
+#if configNUM_THREAD_LOCAL_STORAGE_POINTERS > 0
+
+extern "C" void vTaskSetThreadLocalStoragePointer(TaskHandle_t xTaskToSet,
+                                                  BaseType_t xIndex,
+                                                  void *pvValue)
+{
+    tskTaskControlBlock *thread = xTaskToSet ? xTaskToSet : xTaskGetCurrentTaskHandle();
+    if (thread && xIndex >= 0 && xIndex < configNUM_THREAD_LOCAL_STORAGE_POINTERS)
+    {
+        thread->local_storage[xIndex] = pvValue;
+    }
+}
+
+extern "C" void *pvTaskGetThreadLocalStoragePointer(TaskHandle_t xTaskToQuery,
+                                                    BaseType_t xIndex)
+{
+    tskTaskControlBlock *thread = xTaskToQuery ? xTaskToQuery : xTaskGetCurrentTaskHandle();
+    if (thread && xIndex >= 0 && xIndex < configNUM_THREAD_LOCAL_STORAGE_POINTERS)
+    {
+        return thread->local_storage[xIndex];
     }
     return NULL;
 }
 
+#if configTHREAD_LOCAL_STORAGE_DELETE_CALLBACKS && ESP_PLATFORM
+extern "C" void vTaskSetThreadLocalStoragePointerAndDelCallback(TaskHandle_t xTaskToSet,
+                                                                BaseType_t xIndex,
+                                                                void *pvValue,
+                                                                TlsDeleteCallbackFunction_t pvDelCallback)
+{
+    tskTaskControlBlock *thread = xTaskToSet ? xTaskToSet : xTaskGetCurrentTaskHandle();
+    if (thread && xIndex >= 0 && xIndex < configNUM_THREAD_LOCAL_STORAGE_POINTERS)
+    {
+        thread->local_storage[xIndex] = pvValue;
+        thread->local_storage_delete[xIndex] = pvDelCallback;
+    }
+}
+#endif
+
+#endif
+
 extern "C" TaskHandle_t xTaskGetIdleTaskHandleForCPU(UBaseType_t cpuid)
 {
-    /* No need to implement */
-    return NULL;
+    return (cpuid < configNUM_CORES) ? idle_tasks[cpuid] : NULL;
+}
+
+extern "C" TaskHandle_t xTaskGetIdleTaskHandle(void)
+{
+    return idle_tasks[xPortGetCoreID()];
+}
+
+extern "C" BaseType_t xPortGetCoreID(void)
+{
+    return InternalKernel::core_id();
 }
 
 extern "C" BaseType_t xTaskGetSchedulerState(void)
 {
-    return taskSCHEDULER_RUNNING;
+    return InternalKernel::scheduler_state();
 }
 
 extern "C" eTaskState eTaskGetState(TaskHandle_t xTask)
 {
-    std::unique_lock<std::mutex> lk(task_management_mutex);
-    if (!xTask)
+    if (!xTask || xTask == xTaskGetCurrentTaskHandle())
     {
         return eRunning;
     }
-    tskTaskControlBlock *thread = xTask;
-    for (auto thread_check : deleted_thread_list)
+    eTaskState state = eInvalid;
+    task_registry.visit(xTask, [&state](tskTaskControlBlock *thread)
+                        {
+                            state = prvGetState(thread);
+                        });
+    return state;
+}
+
+extern "C" BaseType_t xTaskGenericNotify(TaskHandle_t xTaskToNotify,
+                                         UBaseType_t uxIndexToNotify,
+                                         uint32_t ulValue,
+                                         eNotifyAction eAction,
+                                         uint32_t *pulPreviousNotificationValue)
+{
+    if (!xTaskToNotify || uxIndexToNotify >= configTASK_NOTIFICATION_ARRAY_ENTRIES)
     {
-        if (thread_check == thread)
-        {
-            return eDeleted;
-        }
+        abort();
     }
-    if (thread->thread_id == pthread_self())
+    const bool stored = xTaskToNotify->notifications.notify(xTaskToNotify->waiter, uxIndexToNotify, ulValue, eAction, pulPreviousNotificationValue, NULL);
+    InternalKernel::yield();
+    return stored ? pdPASS : pdFAIL;
+}
+
+extern "C" BaseType_t xTaskGenericNotifyFromISR(TaskHandle_t xTaskToNotify,
+                                                UBaseType_t uxIndexToNotify,
+                                                uint32_t ulValue,
+                                                eNotifyAction eAction,
+                                                uint32_t *pulPreviousNotificationValue,
+                                                BaseType_t *pxHigherPriorityTaskWoken)
+{
+    if (!xTaskToNotify || uxIndexToNotify >= configTASK_NOTIFICATION_ARRAY_ENTRIES)
     {
-        return eRunning;
+        abort();
     }
-    for (auto thread_check : thread_list)
+    bool woken;
+    const bool stored = xTaskToNotify->notifications.notify(xTaskToNotify->waiter, uxIndexToNotify, ulValue, eAction, pulPreviousNotificationValue, &woken);
+    tskTaskControlBlock *self = xTaskGetCurrentTaskHandle();
+    if (woken && pxHigherPriorityTaskWoken && (!self || xTaskToNotify->priority > self->priority))
     {
-        if (thread_check == thread)
-        {
-            if (thread->thread_suspended)
-            {
-                return eSuspended;
-            }
-            if (thread->thread_started)
-            {
-                return eReady;
-            }
-            break;
-        }
+        *pxHigherPriorityTaskWoken = pdTRUE;
     }
-    return eInvalid;
+    return stored ? pdPASS : pdFAIL;
+}
+
+extern "C" void vTaskGenericNotifyGiveFromISR(TaskHandle_t xTaskToNotify,
+                                              UBaseType_t uxIndexToNotify,
+                                              BaseType_t *pxHigherPriorityTaskWoken)
+{
+    xTaskGenericNotifyFromISR(xTaskToNotify, uxIndexToNotify, 0, eIncrement, NULL, pxHigherPriorityTaskWoken);
+}
+
+extern "C" uint32_t ulTaskGenericNotifyTake(UBaseType_t uxIndexToWaitOn,
+                                            BaseType_t xClearCountOnExit,
+                                            TickType_t xTicksToWait)
+{
+    tskTaskControlBlock *self = xTaskGetCurrentTaskHandle();
+    if (!self || uxIndexToWaitOn >= configTASK_NOTIFICATION_ARRAY_ENTRIES)
+    {
+        abort();
+    }
+    const uint32_t value = self->notifications.take(self->waiter, uxIndexToWaitOn, xClearCountOnExit != pdFALSE, xTicksToWait);
+    InternalKernel::yield();
+    return value;
+}
+
+extern "C" BaseType_t xTaskGenericNotifyWait(UBaseType_t uxIndexToWaitOn,
+                                             uint32_t ulBitsToClearOnEntry,
+                                             uint32_t ulBitsToClearOnExit,
+                                             uint32_t *pulNotificationValue,
+                                             TickType_t xTicksToWait)
+{
+    tskTaskControlBlock *self = xTaskGetCurrentTaskHandle();
+    if (!self || uxIndexToWaitOn >= configTASK_NOTIFICATION_ARRAY_ENTRIES)
+    {
+        abort();
+    }
+    const bool received = self->notifications.wait_bits(self->waiter, uxIndexToWaitOn, ulBitsToClearOnEntry, ulBitsToClearOnExit,
+                                                        pulNotificationValue, xTicksToWait);
+    InternalKernel::yield();
+    return received ? pdTRUE : pdFALSE;
+}
+
+extern "C" BaseType_t xTaskGenericNotifyStateClear(TaskHandle_t xTask, UBaseType_t uxIndexToClear)
+{
+    if (!xTask)
+    {
+        xTask = xTaskGetCurrentTaskHandle();
+    }
+    if (!xTask || uxIndexToClear >= configTASK_NOTIFICATION_ARRAY_ENTRIES)
+    {
+        abort();
+    }
+    return xTask->notifications.clear_state(uxIndexToClear) ? pdPASS : pdFAIL;
+}
+
+extern "C" uint32_t ulTaskGenericNotifyValueClear(TaskHandle_t xTask, UBaseType_t uxIndexToClear, uint32_t ulBitsToClear)
+{
+    if (!xTask)
+    {
+        xTask = xTaskGetCurrentTaskHandle();
+    }
+    if (!xTask || uxIndexToClear >= configTASK_NOTIFICATION_ARRAY_ENTRIES)
+    {
+        abort();
+    }
+    return xTask->notifications.clear_bits(uxIndexToClear, ulBitsToClear);
 }
 
 extern "C" UBaseType_t uxTaskGetNumberOfTasks(void)
 {
-    return thread_list.size();
+    return task_registry.count();
 }
 
 extern "C" UBaseType_t uxTaskGetSystemState(TaskStatus_t *const pxTaskStatusArray,
@@ -396,19 +1501,217 @@ extern "C" UBaseType_t uxTaskGetSystemState(TaskStatus_t *const pxTaskStatusArra
                                             uint32_t *const pulTotalRunTime)
 
 {
-    /* TODO: This mutex can cause a dead lock because of eTaskGetState() */
-    /* std::unique_lock<std::mutex> lk(task_management_mutex); */
-    int i = 0;
-    for (auto thread_check : thread_list)
-    {
-        pxTaskStatusArray[i].pcTaskName = thread_check->_name.c_str();
-        pxTaskStatusArray[i].xTaskNumber = i;
-        pxTaskStatusArray[i].eCurrentState = eTaskGetState(thread_check);
+    UBaseType_t i = 0;
+    task_registry.for_each([&](tskTaskControlBlock *thread)
+                           {
+                               if (i >= uxArraySize)
+                               {
+                                   return;
+                               }
+                               pxTaskStatusArray[i].xHandle = thread;
+                               pxTaskStatusArray[i].pcTaskName = thread->_name.c_str();
+                               pxTaskStatusArray[i].xTaskNumber = thread->task_number;
+                               pxTaskStatusArray[i].eCurrentState = prvGetState(thread);
+                               pxTaskStatusArray[i].uxCurrentPriority = thread->priority;
+                               pxTaskStatusArray[i].uxBasePriority = thread->base_priority;
 #if ESP_PLATFORM
-        pxTaskStatusArray[i].xCoreID = 0;
+                               pxTaskStatusArray[i].xCoreID = thread->core_id;
+#endif
+                               pxTaskStatusArray[i].usStackHighWaterMark = thread->high_water_mark();
+                               InternalStack *stack = thread->waiter.stack;
+                               pxTaskStatusArray[i].pxStackBase = stack ? (StackType_t *)stack->base() : NULL;
+                               pxTaskStatusArray[i].ulRunTimeCounter = (uint32_t)(thread->run_time_ns() / 1000);
+                               i++;
+                           });
+#if configGENERATE_RUN_TIME_STATS
+    const uint64_t elapsed_us = prvRunTimeUs();
+    uint64_t busy_us[configNUM_CORES];
+    prvBusyTimes(busy_us);
+    for (UBaseType_t task = 0; task < i; task++)
+    {
+        for (BaseType_t core = 0; core < configNUM_CORES; core++)
+        {
+            if (pxTaskStatusArray[task].xHandle == idle_tasks[core])
+            {
+                pxTaskStatusArray[task].ulRunTimeCounter = prvIdleRunTime(core, busy_us, elapsed_us);
+            }
+        }
+    }
+#endif
+    if (pulTotalRunTime)
+    {
+#if configGENERATE_RUN_TIME_STATS
+        *pulTotalRunTime = (uint32_t)elapsed_us;
+#else
+        *pulTotalRunTime = 0;
+#endif
+    }
+    return i;
+}
+
+extern "C" uint32_t ulTaskGetIdleRunTimeCounter(void)
+{
+#if configGENERATE_RUN_TIME_STATS
+    uint64_t busy_us[configNUM_CORES];
+    prvBusyTimes(busy_us);
+    return prvIdleRunTime(xPortGetCoreID(), busy_us, prvRunTimeUs());
+#else
+    return 0;
+#endif
+}
+
+extern "C" void vTaskList(char *pcWriteBuffer)
+{
+    *pcWriteBuffer = '\0';
+    for (const TaskStatus_t &task : prvSystemState(NULL))
+    {
+        char status;
+        switch (task.eCurrentState)
+        {
+        case eRunning:
+            status = 'X';
+            break;
+        case eReady:
+            status = 'R';
+            break;
+        case eBlocked:
+            status = 'B';
+            break;
+        case eSuspended:
+            status = 'S';
+            break;
+        case eDeleted:
+            status = 'D';
+            break;
+        default:
+            status = '?';
+            break;
+        }
+        pcWriteBuffer = prvWriteNameToBuffer(pcWriteBuffer, task.pcTaskName);
+#if ESP_PLATFORM && CONFIG_FREERTOS_VTASKLIST_INCLUDE_COREID
+        sprintf(pcWriteBuffer, "\t%c\t%u\t%d\t%u\t%u\r\n", status, (unsigned int)task.uxCurrentPriority, (int)task.xCoreID,
+                (unsigned int)task.usStackHighWaterMark, (unsigned int)task.xTaskNumber);
+#else
+        sprintf(pcWriteBuffer, "\t%c\t%u\t%u\t%u\r\n", status, (unsigned int)task.uxCurrentPriority,
+                (unsigned int)task.usStackHighWaterMark, (unsigned int)task.xTaskNumber);
 #endif
-        pxTaskStatusArray[i].usStackHighWaterMark = 0;
-        i++;
+        pcWriteBuffer += strlen(pcWriteBuffer);
+    }
+}
+
+extern "C" void vTaskGetRunTimeStats(char *pcWriteBuffer)
+{
+    *pcWriteBuffer = '\0';
+    uint32_t total_time;
+    const std::vector<TaskStatus_t> tasks = prvSystemState(&total_time);
+    /* Percentages of the total time, the same integer arithmetic as in tasks.c */
+    total_time /= 100UL;
+    if (total_time == 0)
+    {
+        return;
+    }
+    for (const TaskStatus_t &task : tasks)
+    {
+        const uint32_t percentage = task.ulRunTimeCounter / total_time;
+        pcWriteBuffer = prvWriteNameToBuffer(pcWriteBuffer, task.pcTaskName);
+        if (percentage > 0)
+        {
+            sprintf(pcWriteBuffer, "\t%lu\t\t%lu%%\r\n", (unsigned long)task.ulRunTimeCounter, (unsigned long)percentage);
+        }
+        else
+        {
+            sprintf(pcWriteBuffer, "\t%lu\t\t<1%%\r\n", (unsigned long)task.ulRunTimeCounter);
+        }
+        pcWriteBuffer += strlen(pcWriteBuffer);
+    }
+}
+
+extern "C" uint32_t ulPortGetRunTimeCounterValue(void)
+{
+    return (uint32_t)prvRunTimeUs();
+}
+
+extern "C" void vPortGetTaskDeadlineStats(void *pvTask, uint32_t *pulMissedDeadlines, uint32_t *pulMaxWakeLatencyUs)
+{
+    uint32_t missed = 0;
+    uint32_t latency_us = 0;
+    tskTaskControlBlock *task = pvTask ? static_cast<tskTaskControlBlock *>(pvTask) : xTaskGetCurrentTaskHandle();
+    task_registry.visit(task, [&](tskTaskControlBlock *thread)
+                        {
+                            missed = thread->missed_deadlines;
+                            latency_us = thread->max_wake_latency_us;
+                        });
+    if (pulMissedDeadlines)
+    {
+        *pulMissedDeadlines = missed;
+    }
+    if (pulMaxWakeLatencyUs)
+    {
+        *pulMaxWakeLatencyUs = latency_us;
+    }
+}
+
+extern "C" void vPortGetTaskContextSwitches(void *pvTask, uint32_t *pulVoluntary, uint32_t *pulInvoluntary)
+{
+    uint32_t voluntary = 0;
+    uint32_t involuntary = 0;
+    tskTaskControlBlock *task = pvTask ? static_cast<tskTaskControlBlock *>(pvTask) : xTaskGetCurrentTaskHandle();
+    task_registry.visit(task, [&](tskTaskControlBlock *thread)
+                        {
+                            thread->context_switches(voluntary, involuntary);
+                        });
+    if (pulVoluntary)
+    {
+        *pulVoluntary = voluntary;
+    }
+    if (pulInvoluntary)
+    {
+        *pulInvoluntary = involuntary;
+    }
+}
+
+extern "C" UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t xTask)
+{
+    return uxTaskGetStackHighWaterMark2(xTask);
+}
+
+extern "C" configSTACK_DEPTH_TYPE uxTaskGetStackHighWaterMark2(TaskHandle_t xTask)
+{
+    tskTaskControlBlock *self = xTaskGetCurrentTaskHandle();
+    if (!xTask || xTask == self)
+    {
+        return self ? self->high_water_mark() : 0;
+    }
+    configSTACK_DEPTH_TYPE mark = 0;
+    task_registry.visit(xTask, [&mark](tskTaskControlBlock *thread)
+                        {
+                            mark = thread->high_water_mark();
+                        });
+    return mark;
+}
+
+extern "C" uint8_t *pxTaskGetStackStart(TaskHandle_t xTask)
+{
+    tskTaskControlBlock *self = xTaskGetCurrentTaskHandle();
+    if (!xTask)
+    {
+        xTask = self;
     }
-    return thread_list.size();
+    uint8_t *base = NULL;
+    task_registry.visit(xTask, [&base](tskTaskControlBlock *thread)
+                        {
+                            InternalStack *stack = thread->waiter.stack;
+                            base = stack ? (uint8_t *)stack->base() : NULL;
+                        });
+    return base;
 }
+
+#if configCHECK_FOR_STACK_OVERFLOW > 0
+/** Stands in until the application defines its own hook, as it has to for tasks.c */
+extern "C" __attribute__((weak)) void vApplicationStackOverflowHook(TaskHandle_t xTask, char *pcTaskName)
+{
+    (void)xTask;
+    fprintf(stderr, "Stack overflow in task %s\n", pcTaskName ? pcTaskName : "?");
+    abort();
+}
+#endif
@@ -0,0 +1,239 @@
+/**
+ * @file mock_thread_pool.cpp
+ * @author Stanislav Karpikov
+ * @brief Mock layer for FreeRTOS, host threads recycled between tasks
+ */
+
+/*--------------------------------------------------------------
+                       INCLUDES
+--------------------------------------------------------------*/
+
+#include <cstdint>
+#include <vector>
+#include <pthread.h>
+#include "internal_thread_pool.h"
+
+/*--------------------------------------------------------------
+                       PRIVATE DEFINES
+--------------------------------------------------------------*/
+
+/* Room below the stack pointer for the frames of the repaint itself */
+#define REPAINT_MARGIN 1024
+
+/*--------------------------------------------------------------
+                       PRIVATE TYPES
+--------------------------------------------------------------*/
+
+/** Pool thread, owned by the thread itself while it is parked or running */
+struct InternalThreadPool::Worker
+{
+    std::mutex mutex;
+    std::condition_variable assigned;
+    /** Job to run, NULL while parked */
+    Job *job = nullptr;
+    InternalStack stack;
+    pthread_t thread;
+};
+
+/** Thrown by exit(), only the pool loop catches it */
+struct ThreadExit
+{
+};
+
+/*--------------------------------------------------------------
+                       PRIVATE DATA
+--------------------------------------------------------------*/
+
+static std::mutex pool_mutex;
+static std::vector<InternalThreadPool::Worker *> parked_workers;
+
+/*--------------------------------------------------------------
+                       PRIVATE FUNCTIONS
+--------------------------------------------------------------*/
+
+/** Parks the worker, false if the pool is full or the stack belongs to the application */
+static bool prvPark(InternalThreadPool::Worker *worker)
+{
+    if (!worker->stack.owned())
+    {
+        return false;
+    }
+#if configMOCK_TASK_POOL_SIZE > 0
+    std::unique_lock<std::mutex> lock(pool_mutex);
+    if (parked_workers.size() >= configMOCK_TASK_POOL_SIZE)
+    {
+        return false;
+    }
+    parked_workers.push_back(worker);
+    return true;
+#else
+    return false;
+#endif
+}
+
+/** @return false if the thread has to exit after the job */
+static bool prvRun(InternalThreadPool::Worker *worker, InternalThreadPool::Job *job)
+{
+    try
+    {
+        job->entry(job->arg);
+    }
+    catch (const ThreadExit &)
+    {
+    }
+    pthread_setname_np(pthread_self(), "task pool");
+    const bool parked = prvPark(worker);
+    /* The job goes away with its owner as soon as it is joined, it is not touched after the signal */
+    std::unique_lock<std::mutex> lock(job->mutex);
+    job->retired = parked ? nullptr : worker;
+    job->finished = true;
+    job->done.notify_all();
+    return parked;
+}
+
+static void *prvWorkerLoop(void *arg)
+{
+    InternalThreadPool::Worker *worker = static_cast<InternalThreadPool::Worker *>(arg);
+    while (true)
+    {
+        InternalThreadPool::Job *job;
+        {
+            std::unique_lock<std::mutex> lock(worker->mutex);
+            worker->assigned.wait(lock, [worker]()
+                                  {
+                                      return worker->job != nullptr;
+                                  });
+            job = worker->job;
+            worker->job = nullptr;
+        }
+        /* Every task starts with a painted stack, the previous one may have used it */
+        const uintptr_t here = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+        worker->stack.repaint(reinterpret_cast<const char *>(here - REPAINT_MARGIN));
+        if (!prvRun(worker, job))
+        {
+            return nullptr;
+        }
+    }
+}
+
+/**
+ * Starts a thread that runs the job first, or waits for one if job is NULL.
+ * @return the worker, only valid until it has run a job; NULL if no thread could be spawned
+ */
+static InternalThreadPool::Worker *prvSpawn(InternalThreadPool::Job *job, size_t stack_size, void *stack_buffer)
+{
+    InternalThreadPool::Worker *worker = new InternalThreadPool::Worker();
+    if (stack_buffer)
+    {
+        worker->stack.borrow(stack_buffer, stack_size);
+    }
+    else if (!worker->stack.allocate(stack_size))
+    {
+        delete worker;
+        return nullptr;
+    }
+    worker->job = job;
+    if (job)
+    {
+        job->stack = &worker->stack;
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    int error = pthread_attr_setstack(&attr, worker->stack.base(), worker->stack.size());
+    if (!error)
+    {
+        error = pthread_create(&worker->thread, &attr, prvWorkerLoop, worker);
+    }
+    pthread_attr_destroy(&attr);
+    if (error)
+    {
+        delete worker;
+        return nullptr;
+    }
+    return worker;
+}
+
+/** Smallest parked stack that fits, NULL if there is none */
+static InternalThreadPool::Worker *prvTakeParked(size_t stack_size)
+{
+    std::unique_lock<std::mutex> lock(pool_mutex);
+    auto best = parked_workers.end();
+    for (auto it = parked_workers.begin(); it != parked_workers.end(); ++it)
+    {
+        if ((*it)->stack.size() >= stack_size && (best == parked_workers.end() || (*it)->stack.size() < (*best)->stack.size()))
+        {
+            best = it;
+        }
+    }
+    if (best == parked_workers.end())
+    {
+        return nullptr;
+    }
+    InternalThreadPool::Worker *worker = *best;
+    parked_workers.erase(best);
+    return worker;
+}
+
+/*--------------------------------------------------------------
+                      PUBLIC FUNCTIONS
+--------------------------------------------------------------*/
+
+bool InternalThreadPool::start(Job &job)
+{
+    job.started = true;
+    job.finished = false;
+    job.retired = nullptr;
+    Worker *worker = job.stack_buffer ? nullptr : prvTakeParked(job.stack_size);
+    if (!worker)
+    {
+        job.started = (prvSpawn(&job, job.stack_size, job.stack_buffer) != nullptr);
+        return job.started;
+    }
+    std::unique_lock<std::mutex> lock(worker->mutex);
+    job.stack = &worker->stack;
+    worker->job = &job;
+    worker->assigned.notify_one();
+    return true;
+}
+
+void InternalThreadPool::join(Job &job)
+{
+    if (!job.started)
+    {
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> lock(job.mutex);
+        job.done.wait(lock, [&job]()
+                      {
+                          return job.finished;
+                      });
+    }
+    job.started = false;
+    if (job.retired)
+    {
+        /* The stack may only go once the thread is off it */
+        pthread_join(job.retired->thread, nullptr);
+        delete job.retired;
+        job.retired = nullptr;
+    }
+}
+
+void InternalThreadPool::reserve(size_t count, size_t stack_size)
+{
+    std::unique_lock<std::mutex> lock(pool_mutex);
+    while (parked_workers.size() < count)
+    {
+        Worker *worker = prvSpawn(nullptr, stack_size, nullptr);
+        if (!worker)
+        {
+            return;
+        }
+        parked_workers.push_back(worker);
+    }
+}
+
+void InternalThreadPool::exit(void)
+{
+    throw ThreadExit();
+}
@@ -76,10 +76,25 @@ void vPortDeleteThread( void *pvThreadToDelete );
 #define pvPortMallocTcbMem(size)        malloc(size)
 #define pvPortMallocStackMem(size)      malloc(sizeof(StackType_t)*size)
 
-static inline BaseType_t xPortGetCoreID(void)
-{
-    return 0;
-}
+/* Core of the calling task (see configMOCK_SCHEDULER), 0 outside the tasks */
+BaseType_t xPortGetCoreID(void);
+
+/* Run-time statistics: microseconds since the program start, the tasks are given their host CPU time */
+uint32_t ulPortGetRunTimeCounterValue(void);
+#ifndef portCONFIGURE_TIMER_FOR_RUN_TIME_STATS
+#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()
+#endif
+#ifndef portGET_RUN_TIME_COUNTER_VALUE
+#define portGET_RUN_TIME_COUNTER_VALUE() ulPortGetRunTimeCounterValue()
+#endif
+
+/* Voluntary and involuntary context switches of a task (NULL for the calling one), needs configGENERATE_RUN_TIME_STATS */
+void vPortGetTaskContextSwitches(void *pvTask, uint32_t *pulVoluntary, uint32_t *pulInvoluntary);
+
+/* xTaskDelayUntil() calls of a task (NULL for the calling one) that found their wake time passed, and the
+ * longest host time in microseconds a wake-up came late (0 with configMOCK_VIRTUAL_TIME) */
+void vPortGetTaskDeadlineStats(void *pvTask, uint32_t *pulMissedDeadlines, uint32_t *pulMaxWakeLatencyUs);
+
 /*
  * Send an interrupt to another core in order to make the task running
  * on it yield for a higher-priority task.
@@ -181,6 +196,11 @@ static inline void vPortExitCritical( portMUX_TYPE *mux )
 
 #include "esp_timer.h"
 
+static inline uint64_t port_get_time_ns(void)
+{
+    return (uint64_t)esp_timer_get_time()*1000;
+}
+
 static inline unsigned long port_get_time_ms(void)
 {
     return esp_timer_get_time()/1000;
@@ -190,9 +210,18 @@ static inline unsigned long port_get_time_ms(void)
 
 #include <time.h>
 
+/* Monotonic time, not affected by wall clock adjustments. On Linux
+ * clock_gettime() is served by the vDSO and does not enter the kernel. */
+static inline uint64_t port_get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
 static inline unsigned long port_get_time_ms(void)
 {
-    return time(NULL);
+    return port_get_time_ns()/1000000ULL;
 }
 
 #endif
@@ -1,6 +1,8 @@
 #pragma once
 #include "cpptime.h"
 #include "portmacro.h"
+#include "internal_host.h"
+#include "internal_kernel.h"
 
 using namespace std::chrono;
 
@@ -40,6 +42,29 @@ public:
     {
         stop();
         scoped_m lock(m);
+#if configMOCK_VIRTUAL_TIME
+        /* Timers expire on the virtual clock, the callbacks run on the clock thread */
+        if(single_shot)
+        {
+            id = InternalKernel::add_timer(pdMS_TO_TICKS(period),
+                                           [this]() {
+                                               if (pxCallbackFunction) {
+                                                   pxCallbackFunction(arg);
+                                               }
+                                               active = false;
+                                           }, 0);
+        }
+        else
+        {
+            id = InternalKernel::add_timer(pdMS_TO_TICKS(period),
+                                           [this]() {
+                                               if (pxCallbackFunction) {
+                                                   pxCallbackFunction(arg);
+                                               }
+                                           }, pdMS_TO_TICKS(period));
+        }
+        active = true;
+#else
         if(single_shot)
         {
             id = xtimer().add(milliseconds(period),
@@ -61,6 +86,7 @@ public:
                 }, milliseconds(period));
             active = true;
         }
+#endif
         expiry_time = port_get_time_ms() + period;
     }
 
@@ -69,7 +95,11 @@ public:
         scoped_m lock(m);
         if(active)
         {
+#if configMOCK_VIRTUAL_TIME
+            InternalKernel::remove_timer(id);
+#else
             xtimer().remove(id);
+#endif
             active = false;
         }
     }
@@ -110,13 +140,26 @@ public:
 
     static CppTime::Timer& xtimer() {
         static CppTime::Timer _xtimer;
+        static bool helper_setup = [](){
+            /* The callbacks run on the CppTime thread: give it the place of the timer service task */
+            _xtimer.add(milliseconds(0), [](CppTime::timer_id) {
+                InternalHost::set_priority(pthread_self(), InternalHost::thread_id(), configTIMER_TASK_PRIORITY);
+                InternalHost::pin_helper();
+            });
+            return true;
+        }();
+        (void)helper_setup;
         return _xtimer;
     }
 
     using scoped_m = std::unique_lock<std::mutex>;
     uint64_t expiry_time;
     std::mutex m;
+#if configMOCK_VIRTUAL_TIME
+    InternalKernel::timer_id id;
+#else
     CppTime::timer_id id;
+#endif
     int period;
     bool single_shot;
     callback_function_t pxCallbackFunction;